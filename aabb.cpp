@@ -3,6 +3,7 @@
 #include "vec3.h"
 #include "mat4.h"
 #include "ray.h"
+#include "simd.h"
 
 bool AABB::hit(const Ray &ray, float tmin, float tmax) const
 { 
@@ -58,7 +59,8 @@ AABB transform_bounding_box(const AABB &box, const Mat4 &T)
         for (int a = 0; a < 3; a++) {
             if (tc[a] < tmin[a]) {
                 tmin[a] = tc[a];
-            } else if (tc[a] > tmax[a]) {
+            }
+            if (tc[a] > tmax[a]) {
                 tmax[a] = tc[a];
             }
         }
@@ -66,3 +68,15 @@ AABB transform_bounding_box(const AABB &box, const Mat4 &T)
     
     return AABB(tmin, tmax);
 }
+
+AABB transform_bounding_box(const AABB &box, const Affine3 &T)
+{
+    // the center maps to the center, the half extent along each axis is
+    // the absolute linear part applied to the original one
+    Vec3A center = 0.5f * (Vec3A(box.min()) + Vec3A(box.max()));
+    Vec3A half = 0.5f * (Vec3A(box.max()) - Vec3A(box.min()));
+    Vec3A c = T.transform_point(center);
+    Vec3A h = abs(T.column(0)) * broadcast<0>(half) + abs(T.column(1)) * broadcast<1>(half)
+            + abs(T.column(2)) * broadcast<2>(half);
+    return AABB((c - h).to_vec3(), (c + h).to_vec3());
+}
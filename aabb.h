@@ -7,6 +7,7 @@
 #include <limits>
 
 class Mat4;
+class Affine3;
 class Ray;
 
 class AABB
@@ -30,3 +31,5 @@ AABB surrounding_box(const AABB &box0, const AABB &box1);
 
 AABB transform_bounding_box(const AABB &box, const Mat4 &T);
 
+AABB transform_bounding_box(const AABB &box, const Affine3 &T);
+
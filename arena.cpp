@@ -0,0 +1,87 @@
+#include "arena.h"
+
+#include <stdlib.h>
+#include <iostream>
+
+Arena::~Arena()
+{
+    reset();
+    free(head);
+}
+
+void *Arena::allocate_slow(size_t size, size_t align)
+{
+    size_t data_size = size + align > block_size ? size + align : block_size;
+    Block *block = static_cast<Block *>(malloc(sizeof(Block) + data_size));
+    if (!block) {
+        std::cerr << "Error: arena out of memory (" << size << " bytes)" << std::endl;
+        abort();
+    }
+    block->size = data_size;
+
+    char *data = reinterpret_cast<char *>(block + 1);
+    if (data_size > block_size && head) {
+        // an oversized request gets its own block, the current one stays in use
+        block->next = head->next;
+        head->next = block;
+        uintptr_t p = (reinterpret_cast<uintptr_t>(data) + align - 1) & ~uintptr_t(align - 1);
+        used_bytes += size;
+        return reinterpret_cast<void *>(p);
+    }
+
+    block->next = head;
+    head = block;
+    cur = data;
+    end = data + data_size;
+    return allocate(size, align);
+}
+
+void Arena::add_finalizer(void *object, void (*fn)(void *))
+{
+    Finalizer *f = make<Finalizer>();
+    f->fn = fn;
+    f->object = object;
+    f->next = finalizers;
+    finalizers = f;
+}
+
+void Arena::reset()
+{
+    // the list starts with the newest object
+    for (Finalizer *f = finalizers; f; f = f->next) {
+        f->fn(f->object);
+    }
+    finalizers = nullptr;
+
+    // one default sized block is kept, so that refilling the arena doesn't
+    // go back to malloc
+    Block *keep = nullptr;
+    for (Block *block = head; block; ) {
+        Block *next = block->next;
+        if (keep == nullptr && block->size == block_size) {
+            keep = block;
+        } else {
+            free(block);
+        }
+        block = next;
+    }
+
+    head = keep;
+    if (head) {
+        head->next = nullptr;
+        cur = reinterpret_cast<char *>(head + 1);
+        end = cur + head->size;
+    } else {
+        cur = end = nullptr;
+    }
+    used_bytes = 0;
+}
+
+size_t Arena::capacity() const
+{
+    size_t total = 0;
+    for (Block *block = head; block; block = block->next) {
+        total += block->size;
+    }
+    return total;
+}
@@ -0,0 +1,107 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+// Bump allocator for objects that live as long as a scene. Objects are
+// placed one after the other in large blocks, and are all released at once
+// by reset() or the destructor; destructors of non trivial types are
+// recorded and run in reverse order of creation. Not thread safe.
+class Arena
+{
+public:
+    Arena(size_t _block_size = 64 * 1024)
+    : head(nullptr), finalizers(nullptr), cur(nullptr), end(nullptr), block_size(_block_size), used_bytes(0) { }
+
+    ~Arena();
+
+    Arena(const Arena &) = delete;
+
+    Arena& operator=(const Arena &) = delete;
+
+    void *allocate(size_t size, size_t align)
+    {
+        uintptr_t p = (reinterpret_cast<uintptr_t>(cur) + align - 1) & ~uintptr_t(align - 1);
+        if (cur == nullptr || p + size > reinterpret_cast<uintptr_t>(end)) {
+            return allocate_slow(size, align);
+        }
+        cur = reinterpret_cast<char *>(p + size);
+        used_bytes += size;
+        return reinterpret_cast<void *>(p);
+    }
+
+    template<typename T, typename... Args>
+    T *make(Args&&... args)
+    {
+        T *object = new (allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+        if (!std::is_trivially_destructible<T>::value) {
+            add_finalizer(object, &destroy<T>);
+        }
+        return object;
+    }
+
+    // n default constructed elements of a trivially destructible type
+    template<typename T>
+    T *make_array(size_t n)
+    {
+        static_assert(std::is_trivially_destructible<T>::value, "array elements are never destroyed");
+        T *array = static_cast<T *>(allocate(n * sizeof(T), alignof(T)));
+        for (size_t i = 0; i < n; ++i) {
+            new (array + i) T;
+        }
+        return array;
+    }
+
+    // takes ownership of an object allocated with new
+    template<typename T>
+    T *own(T *object)
+    {
+        if (object) {
+            add_finalizer(object, &release<T>);
+        }
+        return object;
+    }
+
+    // destroys every object, the first block is kept for reuse
+    void reset();
+
+    // bytes handed out since the last reset
+    size_t used() const { return used_bytes; }
+
+    // bytes held in blocks
+    size_t capacity() const;
+
+private:
+    struct Block
+    {
+        Block *next;
+        size_t size;
+    };
+
+    struct Finalizer
+    {
+        void (*fn)(void *);
+        void *object;
+        Finalizer *next;
+    };
+
+    template<typename T>
+    static void destroy(void *object) { static_cast<T *>(object)->~T(); }
+
+    template<typename T>
+    static void release(void *object) { delete static_cast<T *>(object); }
+
+    void *allocate_slow(size_t size, size_t align);
+
+    void add_finalizer(void *object, void (*fn)(void *));
+
+    Block *head;
+    Finalizer *finalizers;
+    char *cur;
+    char *end;
+    size_t block_size;
+    size_t used_bytes;
+};
@@ -0,0 +1,317 @@
+// Micro-benchmarks of the intersection kernels, the BVH traversals and the
+// texture lookups. Every kernel runs over a fixed set of inputs drawn from
+// a seeded generator, so that timings can be compared between builds.
+
+#include "vec3.h"
+#include "ray.h"
+#include "aabb.h"
+#include "sphere.h"
+#include "xy_rectangle.h"
+#include "object_frame.h"
+#include "bvh.h"
+#include "bvh_node.h"
+#include "wide_bvh.h"
+#include "material.h"
+#include "texture.h"
+#include "texture_file.h"
+#include "perlin.h"
+#include "utils.h"
+
+#include <chrono>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <vector>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+namespace {
+
+const uint32_t seed = 0x9e3779b9;
+
+int n_inputs = 1 << 16;
+int repetitions = 15;
+const char *filter = nullptr;
+
+// point uniformly distributed in the box [-s, s]^3
+Vec3 random_in_box(float s)
+{
+    return s * (2.0f * Vec3(random_in_0_1(), random_in_0_1(), random_in_0_1()) - 1.0f);
+}
+
+// rays from a sphere of radius `distance` toward points of [-s, s]^3, a
+// target a bit larger than the objects gives a mix of hits and misses
+std::vector<Ray> make_rays(float distance, float s)
+{
+    s_RndState = seed;
+    std::vector<Ray> rays;
+    for (int i = 0; i < n_inputs; ++i) {
+        Vec3 origin = distance * random_unit_vector();
+        rays.push_back(Ray(origin, random_in_box(s) - origin));
+    }
+    return rays;
+}
+
+struct Timing
+{
+    double mean;
+    double deviation;
+    double min;
+};
+
+// times `repetitions` passes of kernel(i) over all the inputs, after one
+// untimed pass; the kernel returns something to keep the work from being
+// optimized away
+template<typename Kernel>
+Timing measure(Kernel kernel, double &result)
+{
+    std::vector<double> samples;
+    for (int r = 0; r <= repetitions; ++r) {
+        double sum = 0.0;
+        auto start = std::chrono::steady_clock::now();
+        for (int i = 0; i < n_inputs; ++i) {
+            sum += kernel(i);
+        }
+        auto stop = std::chrono::steady_clock::now();
+        if (r > 0) {
+            samples.push_back(std::chrono::duration<double, std::nano>(stop - start).count() / n_inputs);
+        }
+        result = sum;
+    }
+
+    Timing timing;
+    timing.mean = 0.0;
+    timing.min = samples[0];
+    for (double s : samples) {
+        timing.mean += s;
+        timing.min = std::min(timing.min, s);
+    }
+    timing.mean /= samples.size();
+    timing.deviation = 0.0;
+    for (double s : samples) {
+        timing.deviation += (s - timing.mean) * (s - timing.mean);
+    }
+    timing.deviation = samples.size() > 1 ? sqrt(timing.deviation / (samples.size() - 1)) : 0.0;
+    return timing;
+}
+
+bool selected(const char *name)
+{
+    return !filter || std::string(name).find(filter) != std::string::npos;
+}
+
+// `rays` tells whether the kernel traces rays, for the Mrays/s column;
+// `result` is the hit count (or the sum of the values) over one pass
+void report(const char *name, const Timing &timing, bool rays, double result)
+{
+    std::cout << std::left << std::setw(22) << name << std::right << std::fixed
+              << std::setprecision(2) << std::setw(10) << timing.mean
+              << std::setw(9) << timing.deviation
+              << std::setw(10) << timing.min;
+    if (rays) {
+        std::cout << std::setw(10) << 1000.0 / timing.mean;
+    } else {
+        std::cout << std::setw(10) << "-";
+    }
+    std::cout << std::setprecision(0) << std::setw(14) << result << std::endl;
+}
+
+template<typename Kernel>
+void run(const char *name, bool rays, Kernel kernel)
+{
+    if (!selected(name)) {
+        return;
+    }
+    double result = 0.0;
+    Timing timing = measure(kernel, result);
+    report(name, timing, rays, result);
+}
+
+// counts the hits of `hitable` over `rays`
+void run_hitable(const char *name, const Hitable &hitable, const std::vector<Ray> &rays)
+{
+    run(name, true, [&](int i) {
+        Hit hit;
+        return hitable.hit(rays[i], 0.001f, std::numeric_limits<float>::max(), hit) ? 1.0 : 0.0;
+    });
+}
+
+void run_occluded(const char *name, const Hitable &hitable, const std::vector<Ray> &rays)
+{
+    run(name, true, [&](int i) {
+        return hitable.occluded(rays[i], 0.001f, std::numeric_limits<float>::max()) ? 1.0 : 0.0;
+    });
+}
+
+void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --inputs N      rays or lookups per pass (default: 65536)\n"
+              << "  --reps N        timed passes per kernel (default: 15)\n"
+              << "  --filter TEXT   only run the kernels whose name contains TEXT\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool ok = true;
+        if (arg == "--help" || arg == "-h") {
+            usage(argv[0]);
+            return 0;
+        } else if (i + 1 >= argc) {
+            ok = false;
+        } else if (arg == "--inputs") {
+            n_inputs = atoi(argv[++i]);
+            ok = n_inputs > 0;
+        } else if (arg == "--reps") {
+            repetitions = atoi(argv[++i]);
+            ok = repetitions > 0;
+        } else if (arg == "--filter") {
+            filter = argv[++i];
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Error: bad argument " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+    std::cout << n_inputs << " inputs, " << repetitions << " passes, ns/op is per ray or lookup\n"
+              << std::left << std::setw(22) << "kernel" << std::right
+              << std::setw(10) << "ns/op" << std::setw(9) << "+-"
+              << std::setw(10) << "min" << std::setw(10) << "Mrays/s"
+              << std::setw(14) << "hits/sum" << std::endl;
+
+    ConstantTexture white(Vec3(0.8));
+    Lambertian diffuse(&white);
+
+    std::vector<Ray> rays = make_rays(5.0, 1.5);
+
+    AABB box(Vec3(-1.0), Vec3(1.0));
+    run("AABB::hit", true, [&](int i) {
+        return box.hit(rays[i], 0.001f, std::numeric_limits<float>::max()) ? 1.0 : 0.0;
+    });
+
+    Sphere sphere(Vec3(0.0), 1.0, &diffuse);
+    run_hitable("Sphere::hit", sphere, rays);
+
+    XYRectangle rectangle(2.0, 2.0, &diffuse);
+    run_hitable("XYRectangle::hit", rectangle, rays);
+
+    ObjectFrame frame(&sphere);
+    frame.set_transform(20.0, 30.0, 40.0, 0.1, 0.2, 0.3, Vec3(1.2, 0.8, 1.0));
+    run_hitable("ObjectFrame::hit", frame, rays);
+
+    // the same cloud of small spheres in each tree
+    s_RndState = seed;
+    std::vector<Sphere> spheres;
+    for (int i = 0; i < 4096; ++i) {
+        spheres.push_back(Sphere(random_in_box(10.0), 0.1 + 0.2 * random_in_0_1(), &diffuse));
+    }
+    std::vector<Hitable *> cloud;
+    for (Sphere &s : spheres) {
+        cloud.push_back(&s);
+    }
+    std::vector<Ray> cloud_rays = make_rays(30.0, 10.0);
+
+    if (selected("BVHNode::hit")) {
+        std::vector<Hitable *> elems = cloud;
+        BVHNode tree(elems);
+        run_hitable("BVHNode::hit", tree, cloud_rays);
+    }
+
+    if (selected("LinearBVH::hit") || selected("LinearBVH::occluded")) {
+        LinearBVH tree(cloud);
+        run_hitable("LinearBVH::hit", tree, cloud_rays);
+        run_occluded("LinearBVH::occluded", tree, cloud_rays);
+    }
+
+    if (selected("QuantizedBVH::hit") || selected("QuantizedBVH::occluded")) {
+        QuantizedBVH tree(cloud);
+        run_hitable("QuantizedBVH::hit", tree, cloud_rays);
+        run_occluded("QuantizedBVH::occluded", tree, cloud_rays);
+    }
+
+    s_RndState = seed;
+    std::vector<Vec3> points(n_inputs);
+    for (Vec3 &p : points) {
+        p = random_in_box(10.0);
+    }
+    run("Perlin::turb", false, [&](int i) {
+        return Perlin::turb(points[i]);
+    });
+
+    // a noisy synthetic image, large enough to miss the caches
+    const int size = 2048;
+    std::vector<uint8_t> pixels(3 * size * size);
+    for (uint8_t &c : pixels) {
+        c = XorShift32() & 0xff;
+    }
+    MipMap mipmap(pixels.data(), size, size, 3);
+    ImageTexture image(&mipmap);
+
+    s_RndState = seed;
+    std::vector<Vec3> uvs(n_inputs);
+    for (Vec3 &uv : uvs) {
+        uv = Vec3(random_in_0_1(), random_in_0_1(), 0.0);
+    }
+    run("MipMap::nearest", false, [&](int i) {
+        return mipmap.nearest(uvs[i].x(), uvs[i].y()).x();
+    });
+    run("ImageTexture::value", false, [&](int i) {
+        return image.value(uvs[i].x(), uvs[i].y(), Vec3(0.0)).x();
+    });
+    // footprints of 1 to 16 texels, between levels 0 and 4
+    run("ImageTexture::filtered", false, [&](int i) {
+        return image.value(uvs[i].x(), uvs[i].y(), Vec3(0.0), (1.0 + 15.0 * uvs[i].x()) / size).x();
+    });
+
+    // the same image in half floats
+    std::vector<float> hdr_pixels(pixels.size());
+    for (size_t k = 0; k < pixels.size(); ++k) {
+        hdr_pixels[k] = pixels[k] / 255.0f;
+    }
+    MipMap hdr_mipmap(hdr_pixels.data(), size, size, 3);
+    ImageTexture hdr_image(&hdr_mipmap);
+    run("ImageTexture::half", false, [&](int i) {
+        return hdr_image.value(uvs[i].x(), uvs[i].y(), Vec3(0.0), (1.0 + 15.0 * uvs[i].x()) / size).x();
+    });
+
+    // lookups along scanlines of 256 pixels with a footprint of one pixel,
+    // as camera rays make them: neighbours fall in the same tiles. The
+    // paged kernel reads the 8-bit pyramid back from a texture file
+    // through a cache large enough for all of it.
+    const int columns = 256;
+    std::vector<Vec3> scanlines(n_inputs);
+    for (int i = 0; i < n_inputs; ++i) {
+        int rows = (n_inputs + columns - 1) / columns;
+        scanlines[i] = Vec3((i % columns + 0.5f) / columns, 1.0f - (i / columns + 0.5f) / rows, 0.0);
+    }
+    run("ImageTexture::scanline", false, [&](int i) {
+        return image.value(scanlines[i].x(), scanlines[i].y(), Vec3(0.0), 1.0f / columns).x();
+    });
+
+    if (selected("ImageTexture::paged")) {
+        const char *path = "bench_texture.rttex";
+        TextureCache cache;
+        MipMap *paged = write_texture_file(path, mipmap) ? load_texture_file(path, &cache) : nullptr;
+        remove(path);
+        if (paged) {
+            ImageTexture paged_image(paged);
+            run("ImageTexture::paged", false, [&](int i) {
+                return paged_image.value(scanlines[i].x(), scanlines[i].y(), Vec3(0.0), 1.0f / columns).x();
+            });
+            delete paged;
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,418 @@
+#include "bvh.h"
+#include "utils.h"
+#include "arena.h"
+
+#include <algorithm>
+#include <iostream>
+#include <limits>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+
+namespace {
+
+const char bvh_magic[8] = { 'R', 'T', 'B', 'V', 'H', 0, 0, 0 };
+// 2: leaves hold at most 255 primitives, for the quantized nodes
+const uint32_t bvh_version = 2;
+
+struct BVHFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t n_nodes;
+    uint64_t hash;
+    uint32_t n_indices;
+    uint32_t reserved;
+    uint64_t nodes_offset;
+    uint64_t indices_offset;
+};
+
+uint64_t align_up(uint64_t x, uint64_t a)
+{
+    return (x + a - 1) & ~(a - 1);
+}
+
+struct BuildPrim
+{
+    AABB box;
+    Vec3 centroid;
+    uint32_t index;
+};
+
+float surface_area(const AABB &box)
+{
+    Vec3 d = box.max() - box.min();
+    return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+AABB empty_box()
+{
+    return AABB(Vec3(std::numeric_limits<float>::max()), Vec3(std::numeric_limits<float>::lowest()));
+}
+
+struct Builder
+{
+    const BVHSettings &settings;
+    BuildPrim *prims;
+    std::vector<BVHFlatNode> &nodes;
+
+    // SAH sweep storage, shared by all the nodes
+    AABB *bin_boxes;
+    int *bin_counts;
+    float *right_cost;
+
+    // past this depth only median splits are used
+    static const int max_sah_depth = 40;
+
+    // Median splits halve the primitives, so a node at depth d with n of
+    // them gets leaves no deeper than d + ceil(log2(n)). SAH splits may
+    // only shed one primitive and are used while that bound stays below
+    // BVHTree::max_depth a level further down; 2^32 primitives fit at the
+    // root.
+    static bool sah_fits(int depth, int n)
+    {
+        int log2_n = 0;
+        while ((int64_t(1) << log2_n) < n) {
+            ++log2_n;
+        }
+        return depth + 1 + log2_n < BVHTree::max_depth;
+    }
+
+    uint32_t build(int begin, int end, int depth)
+    {
+        uint32_t node_index = nodes.size();
+        nodes.push_back(BVHFlatNode());
+
+        AABB box = empty_box();
+        AABB centroid_box = empty_box();
+        for (int i = begin; i < end; ++i) {
+            box = surrounding_box(box, prims[i].box);
+            centroid_box = surrounding_box(centroid_box, AABB(prims[i].centroid, prims[i].centroid));
+        }
+
+        int n = end - begin;
+        Vec3 extent = centroid_box.max() - centroid_box.min();
+        int axis = 0;
+        if (extent[1] > extent[axis]) axis = 1;
+        if (extent[2] > extent[axis]) axis = 2;
+
+        if (n <= std::min(settings.max_leaf_size, 255) || (extent[axis] <= 0.0f && n <= 255)) {
+            make_leaf(node_index, box, begin, n);
+            return node_index;
+        }
+
+        int mid = -1;
+        if (settings.sah_bins > 1 && depth < max_sah_depth && sah_fits(depth, n) && extent[axis] > 0.0f) {
+            mid = sah_partition(begin, end, axis, centroid_box);
+        }
+        if (mid <= begin || mid >= end) {
+            mid = begin + n / 2;
+            std::nth_element(prims + begin, prims + mid, prims + end,
+                [axis](const BuildPrim &a, const BuildPrim &b) {
+                    return a.centroid[axis] < b.centroid[axis];
+                });
+        }
+
+        build(begin, mid, depth + 1);
+        uint32_t second = build(mid, end, depth + 1);
+
+        BVHFlatNode &node = nodes[node_index];
+        node.bmin = box.min();
+        node.bmax = box.max();
+        node.offset = second;
+        node.count = 0;
+        node.axis = axis;
+        return node_index;
+    }
+
+    void make_leaf(uint32_t node_index, const AABB &box, int begin, int n)
+    {
+        BVHFlatNode &node = nodes[node_index];
+        node.bmin = box.min();
+        node.bmax = box.max();
+        node.offset = begin;
+        node.count = n;
+        node.axis = 0;
+    }
+
+    // binned SAH, returns the split position or -1
+    int sah_partition(int begin, int end, int axis, const AABB &centroid_box)
+    {
+        const int n_bins = settings.sah_bins;
+        std::fill(bin_boxes, bin_boxes + n_bins, empty_box());
+        std::fill(bin_counts, bin_counts + n_bins, 0);
+
+        float cmin = centroid_box.min()[axis];
+        float scale = n_bins / (centroid_box.max()[axis] - cmin);
+        auto bin_of = [&](const BuildPrim &p) {
+            int b = int((p.centroid[axis] - cmin) * scale);
+            return clamp(b, 0, n_bins - 1);
+        };
+
+        for (int i = begin; i < end; ++i) {
+            int b = bin_of(prims[i]);
+            bin_counts[b]++;
+            bin_boxes[b] = surrounding_box(bin_boxes[b], prims[i].box);
+        }
+
+        // sweep from the right to get the cost of every right side
+        std::fill(right_cost, right_cost + n_bins, 0.0f);
+        AABB acc = empty_box();
+        int count = 0;
+        for (int b = n_bins - 1; b > 0; --b) {
+            acc = surrounding_box(acc, bin_boxes[b]);
+            count += bin_counts[b];
+            right_cost[b] = count > 0 ? count * surface_area(acc) : 0.0f;
+        }
+
+        float best_cost = std::numeric_limits<float>::max();
+        int best_split = -1;
+        acc = empty_box();
+        count = 0;
+        for (int b = 0; b < n_bins - 1; ++b) {
+            acc = surrounding_box(acc, bin_boxes[b]);
+            count += bin_counts[b];
+            if (count == 0 || count == end - begin) continue;
+            float cost = count * surface_area(acc) + right_cost[b + 1];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_split = b;
+            }
+        }
+
+        if (best_split < 0) {
+            return -1;
+        }
+
+        BuildPrim *it = std::partition(prims + begin, prims + end,
+            [&](const BuildPrim &p) { return bin_of(p) <= best_split; });
+        return int(it - prims);
+    }
+};
+
+} // namespace
+
+uint64_t bvh_hash(const std::vector<AABB> &boxes, const BVHSettings &settings)
+{
+    // FNV-1a
+    uint64_t h = 14695981039346656037ull;
+    auto mix_bytes = [&h](const void *data, size_t size) {
+        const uint8_t *bytes = static_cast<const uint8_t *>(data);
+        for (size_t i = 0; i < size; ++i) {
+            h ^= bytes[i];
+            h *= 1099511628211ull;
+        }
+    };
+
+    uint64_t count = boxes.size();
+    mix_bytes(&bvh_version, sizeof(bvh_version));
+    mix_bytes(&settings.max_leaf_size, sizeof(settings.max_leaf_size));
+    mix_bytes(&settings.sah_bins, sizeof(settings.sah_bins));
+    mix_bytes(&count, sizeof(count));
+    for (const AABB &box : boxes) {
+        float b[6] = { box.min()[0], box.min()[1], box.min()[2], box.max()[0], box.max()[1], box.max()[2] };
+        mix_bytes(b, sizeof(b));
+    }
+
+    return h;
+}
+
+std::string bvh_cache_path(const char *cache_dir, uint64_t hash)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.bvh", (unsigned long long)hash);
+    return std::string(cache_dir) + "/" + name;
+}
+
+void BVHTree::build(const std::vector<AABB> &boxes, const BVHSettings &settings)
+{
+    mapping.close();
+    owned_nodes.clear();
+    owned_indices.clear();
+
+    // temporaries of the build all come from one arena, released at once
+    size_t n_prims = boxes.size();
+    int n_bins = std::max(settings.sah_bins, 1);
+    Arena scratch(n_prims * sizeof(BuildPrim) + n_bins * (sizeof(AABB) + sizeof(int) + sizeof(float)) + 64);
+    BuildPrim *prims = scratch.make_array<BuildPrim>(n_prims);
+    for (size_t i = 0; i < n_prims; ++i) {
+        prims[i].box = boxes[i];
+        prims[i].centroid = 0.5f * (boxes[i].min() + boxes[i].max());
+        prims[i].index = i;
+    }
+
+    if (n_prims > 0) {
+        owned_nodes.reserve(2 * n_prims);
+        Builder builder = { settings, prims, owned_nodes, scratch.make_array<AABB>(n_bins),
+                            scratch.make_array<int>(n_bins), scratch.make_array<float>(n_bins) };
+        builder.build(0, n_prims, 0);
+    }
+
+    owned_indices.resize(n_prims);
+    for (size_t i = 0; i < n_prims; ++i) {
+        owned_indices[i] = prims[i].index;
+    }
+
+    nodes = owned_nodes.data();
+    indices = owned_indices.data();
+    n_nodes = owned_nodes.size();
+    n_indices = owned_indices.size();
+}
+
+bool BVHTree::load(const char *path, uint64_t hash, uint32_t n_prims)
+{
+    MappedFile file;
+    if (!file.open(path) || file.size() < sizeof(BVHFileHeader)) {
+        return false;
+    }
+
+    const uint8_t *base = static_cast<const uint8_t *>(file.data());
+    BVHFileHeader header;
+    memcpy(&header, base, sizeof(header));
+
+    if (memcmp(header.magic, bvh_magic, sizeof(bvh_magic)) != 0 || header.version != bvh_version
+        || header.hash != hash || header.n_indices != n_prims || header.n_nodes == 0) {
+        return false;
+    }
+
+    if (header.nodes_offset % alignof(BVHFlatNode) != 0 || header.indices_offset % alignof(uint32_t) != 0
+        || header.nodes_offset + uint64_t(header.n_nodes) * sizeof(BVHFlatNode) > file.size()
+        || header.indices_offset + uint64_t(header.n_indices) * sizeof(uint32_t) > file.size()) {
+        return false;
+    }
+
+    const BVHFlatNode *file_nodes = reinterpret_cast<const BVHFlatNode *>(base + header.nodes_offset);
+    const uint32_t *file_indices = reinterpret_cast<const uint32_t *>(base + header.indices_offset);
+    if (!attach(file_nodes, header.n_nodes, file_indices, header.n_indices, n_prims)) {
+        return false;
+    }
+
+    mapping.swap(file);
+    return true;
+}
+
+bool BVHTree::attach(const BVHFlatNode *_nodes, uint32_t _n_nodes, const uint32_t *_indices, uint32_t _n_indices,
+                     uint32_t n_prims)
+{
+    // damaged data must not send the traversal out of bounds
+    if (_n_nodes == 0 || _n_indices != n_prims) {
+        return false;
+    }
+    for (uint32_t i = 0; i < _n_nodes; ++i) {
+        const BVHFlatNode &node = _nodes[i];
+        if (node.count > 0) {
+            if (node.count > 255 || uint64_t(node.offset) + node.count > _n_indices) return false;
+        } else if (node.offset <= i + 1 || node.offset >= _n_nodes || node.axis > 2) {
+            return false;
+        }
+    }
+    for (uint32_t i = 0; i < _n_indices; ++i) {
+        if (_indices[i] >= n_prims) return false;
+    }
+
+    // one walk from the root, in which every node must be reached once and
+    // less deep than the traversal stacks allow
+    std::vector<bool> reached(_n_nodes, false);
+    std::vector<std::pair<uint32_t, int>> pending(1, std::make_pair(0u, 0));
+    while (!pending.empty()) {
+        uint32_t i = pending.back().first;
+        int depth = pending.back().second;
+        pending.pop_back();
+        if (reached[i] || depth >= max_depth) return false;
+        reached[i] = true;
+        if (_nodes[i].count == 0) {
+            pending.push_back(std::make_pair(_nodes[i].offset, depth + 1));
+            pending.push_back(std::make_pair(i + 1, depth + 1));
+        }
+    }
+
+    mapping.close();
+    owned_nodes.clear();
+    owned_indices.clear();
+    nodes = _nodes;
+    indices = _indices;
+    n_nodes = _n_nodes;
+    n_indices = _n_indices;
+    return true;
+}
+
+bool BVHTree::save(const char *path, uint64_t hash) const
+{
+    BVHFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, bvh_magic, sizeof(bvh_magic));
+    header.version = bvh_version;
+    header.hash = hash;
+    header.n_nodes = n_nodes;
+    header.n_indices = n_indices;
+    header.nodes_offset = align_up(sizeof(header), 64);
+    header.indices_offset = align_up(header.nodes_offset + uint64_t(n_nodes) * sizeof(BVHFlatNode), 64);
+
+    // write aside and rename so concurrent jobs never map a partial file
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *f = fopen(tmp_path.c_str(), "wb");
+    if (!f) {
+        return false;
+    }
+
+    static const char zeros[64] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(zeros, header.nodes_offset - sizeof(header), 1, f) == 1;
+    ok = ok && fwrite(nodes, sizeof(BVHFlatNode), n_nodes, f) == n_nodes;
+    uint64_t pad = header.indices_offset - (header.nodes_offset + uint64_t(n_nodes) * sizeof(BVHFlatNode));
+    ok = ok && (pad == 0 || fwrite(zeros, pad, 1, f) == 1);
+    ok = ok && fwrite(indices, sizeof(uint32_t), n_indices, f) == n_indices;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        remove(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void collect_bounded(const std::vector<Hitable *> &hitables, std::vector<Hitable *> &bounded, std::vector<AABB> &boxes)
+{
+    for (Hitable *h : hitables) {
+        AABB box;
+        if (h->bounding_box(box)) {
+            bounded.push_back(h);
+            boxes.push_back(box);
+        } else {
+            std::cerr << "Error: trying to include infinite object in a BVH" << std::endl;
+        }
+    }
+}
+
+bool load_or_build(BVHTree &tree, const std::vector<AABB> &boxes, const BVHSettings &settings, const char *cache_dir)
+{
+    uint64_t hash = bvh_hash(boxes, settings);
+    std::string path;
+    if (cache_dir) {
+        mkdir(cache_dir, 0755);
+        path = bvh_cache_path(cache_dir, hash);
+        if (tree.load(path.c_str(), hash, boxes.size())) {
+            return true;
+        }
+    }
+
+    tree.build(boxes, settings);
+    if (cache_dir && !tree.save(path.c_str(), hash)) {
+        std::cerr << "Warning: could not write BVH cache " << path << std::endl;
+    }
+    return false;
+}
+
+LinearBVH::LinearBVH(const std::vector<Hitable *> &hitables, const BVHSettings &settings, const char *cache_dir)
+{
+    std::vector<Hitable *> bounded;
+    std::vector<AABB> boxes;
+    collect_bounded(hitables, bounded, boxes);
+
+    cached = load_or_build(tree, boxes, settings, cache_dir);
+
+    prims.resize(bounded.size());
+    for (size_t i = 0; i < bounded.size(); ++i) {
+        prims[i] = bounded[tree.primitive(i)];
+    }
+}
@@ -0,0 +1,404 @@
+#pragma once
+
+#include "hitable.h"
+#include "ray.h"
+#include "mapped_file.h"
+#include "stats.h"
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+struct BVHSettings
+{
+    BVHSettings() : max_leaf_size(4), sah_bins(16) { }
+
+    // at most 255 so that leaves fit the quantized node format
+    int max_leaf_size;
+    // number of bins for the SAH sweep, 0 selects median splits
+    int sah_bins;
+};
+
+// 32 byte node. Interior nodes have their first child right after them and
+// the second one at `offset`; leaves reference `count` entries of the index
+// array starting at `offset`. `axis` is the split axis of interior nodes.
+struct BVHFlatNode
+{
+    Vec3 bmin;
+    uint32_t offset;
+    Vec3 bmax;
+    uint16_t count;
+    uint16_t axis;
+};
+
+static_assert(sizeof(BVHFlatNode) == 32, "BVHFlatNode must stay 32 bytes, it is stored on disk");
+
+// Identifies a tree: the builder is deterministic, so the primitive bounds
+// and the settings fully determine its output
+uint64_t bvh_hash(const std::vector<AABB> &boxes, const BVHSettings &settings);
+
+std::string bvh_cache_path(const char *cache_dir, uint64_t hash);
+
+inline bool slab_hit(const Vec3 &bmin, const Vec3 &bmax, const Vec3 &orig, const Vec3 &inv_dir, float tmin, float tmax)
+{
+    for (int a = 0; a < 3; a++) {
+        float t0 = (bmin[a] - orig[a]) * inv_dir[a];
+        float t1 = (bmax[a] - orig[a]) * inv_dir[a];
+        if (inv_dir[a] < 0.0f) {
+            std::swap(t0, t1);
+        }
+        tmin = t0 > tmin ? t0 : tmin;
+        tmax = t1 < tmax ? t1 : tmax;
+    }
+    // flat boxes (e.g. around a rectangle) have tmin == tmax
+    return tmin <= tmax;
+}
+
+// Flattened BVH over an array of bounding boxes. The node and index arrays
+// either live in memory owned by the tree or in a mapped cache file.
+class BVHTree
+{
+public:
+    // every node is less deep than this, the root being at depth 0, which
+    // bounds the traversal stacks
+    static const int max_depth = 64;
+
+    BVHTree() : nodes(nullptr), indices(nullptr), n_nodes(0), n_indices(0) { }
+
+    BVHTree(const BVHTree &) = delete;
+
+    BVHTree& operator=(const BVHTree &) = delete;
+
+    void build(const std::vector<AABB> &boxes, const BVHSettings &settings);
+
+    // map a tree previously written by save(), fails if the file is
+    // missing, truncated or was built from different inputs
+    bool load(const char *path, uint64_t hash, uint32_t n_prims);
+
+    bool save(const char *path, uint64_t hash) const;
+
+    // use node and index arrays stored elsewhere (e.g. in a mapped mesh
+    // file) in place, after checking that they are consistent and form a
+    // tree no deeper than max_depth; the memory must outlive the tree
+    bool attach(const BVHFlatNode *_nodes, uint32_t _n_nodes, const uint32_t *_indices, uint32_t _n_indices,
+                uint32_t n_prims);
+
+    const uint32_t *index_data() const { return indices; }
+
+    uint32_t node_count() const { return n_nodes; }
+
+    uint32_t index_count() const { return n_indices; }
+
+    const BVHFlatNode *node_data() const { return nodes; }
+
+    // index of the primitive stored at a given leaf position
+    uint32_t primitive(uint32_t i) const { return indices[i]; }
+
+    bool bounds(AABB &box) const
+    {
+        if (n_nodes == 0) return false;
+        box = AABB(nodes[0].bmin, nodes[0].bmax);
+        return true;
+    }
+
+    // front-to-back traversal, leaf_hit(i, ray, tmin, tmax, hit) is called
+    // with leaf positions i and must return true on a closer hit
+    template<typename LeafHit>
+    bool hit(const Ray &ray, float tmin, float tmax, Hit &hit, LeafHit leaf_hit) const;
+
+    // the same for a coherent packet, nodes are culled for the whole packet
+    // first and then lane by lane; leaf_hit is called with the rays of the
+    // lanes that reach a leaf. Same result as hit_packet in Hitable.
+    template<typename LeafHit>
+    uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits, LeafHit leaf_hit) const;
+
+    // any-hit traversal, leaf_occluded(i, ray, tmin, tmax) returns true when
+    // primitive i blocks the ray and the traversal stops there
+    template<typename LeafOccluded>
+    bool occluded(const Ray &ray, float tmin, float tmax, LeafOccluded leaf_occluded) const;
+
+    // the same for a coherent packet, blocked lanes are retired; same
+    // result as occluded_packet in Hitable
+    template<typename LeafOccluded>
+    uint32_t occluded_packet(RayPacket &packet, float tmin, LeafOccluded leaf_occluded) const;
+
+private:
+    std::vector<BVHFlatNode> owned_nodes;
+    std::vector<uint32_t> owned_indices;
+    MappedFile mapping;
+
+    const BVHFlatNode *nodes;
+    const uint32_t *indices;
+    uint32_t n_nodes;
+    uint32_t n_indices;
+};
+
+template<typename LeafHit>
+bool BVHTree::hit(const Ray &ray, float tmin, float tmax, Hit &hit, LeafHit leaf_hit) const
+{
+    if (n_nodes == 0) {
+        return false;
+    }
+
+    STAT_BIND(stats);
+    Vec3 orig = ray.origin();
+    Vec3 dir = ray.direction();
+    Vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    bool dir_neg[3] = { inv_dir.x() < 0.0f, inv_dir.y() < 0.0f, inv_dir.z() < 0.0f };
+
+    uint32_t stack[max_depth];
+    int sp = 0;
+    uint32_t current = 0;
+    bool got_hit = false;
+
+    while (true) {
+        const BVHFlatNode &node = nodes[current];
+        STAT_INC_TO(stats, nodes_visited);
+        if (slab_hit(node.bmin, node.bmax, orig, inv_dir, tmin, tmax)) {
+            if (node.count > 0) {
+                STAT_ADD_TO(stats, primitive_tests, node.count);
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                    if (leaf_hit(i, ray, tmin, tmax, hit)) {
+                        got_hit = true;
+                        tmax = hit.t;
+                    }
+                }
+                if (sp == 0) break;
+                current = stack[--sp];
+            } else if (dir_neg[node.axis]) {
+                stack[sp++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[sp++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (sp == 0) break;
+            current = stack[--sp];
+        }
+    }
+
+    return got_hit;
+}
+
+template<typename LeafHit>
+uint32_t BVHTree::hit_packet(RayPacket &packet, float tmin, Hit *hits, LeafHit leaf_hit) const
+{
+    if (n_nodes == 0) {
+        return 0;
+    }
+
+    STAT_BIND(stats);
+    uint32_t stack[max_depth];
+    int sp = 0;
+    uint32_t current = 0;
+    uint32_t got_hit = 0;
+
+    while (true) {
+        const BVHFlatNode &node = nodes[current];
+        // a visit counts once for the whole packet
+        STAT_INC_TO(stats, nodes_visited);
+        uint32_t mask = 0;
+        if (packet.may_hit(node.bmin, node.bmax, tmin)) {
+            mask = packet.hit_mask(node.bmin, node.bmax, tmin);
+        }
+
+        if (mask) {
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                    for (int k = 0; k < RayPacket::size; ++k) {
+                        if (!(mask >> k & 1)) {
+                            continue;
+                        }
+                        STAT_INC_TO(stats, primitive_tests);
+                        if (leaf_hit(i, packet.ray(k), tmin, packet.tmax(k), hits[k])) {
+                            got_hit |= 1u << k;
+                            packet.shorten(k, hits[k].t);
+                        }
+                    }
+                }
+                if (sp == 0) break;
+                current = stack[--sp];
+            } else if (packet.direction_negative(node.axis)) {
+                stack[sp++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[sp++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (sp == 0) break;
+            current = stack[--sp];
+        }
+    }
+
+    return got_hit;
+}
+
+template<typename LeafOccluded>
+bool BVHTree::occluded(const Ray &ray, float tmin, float tmax, LeafOccluded leaf_occluded) const
+{
+    if (n_nodes == 0) {
+        return false;
+    }
+
+    STAT_BIND(stats);
+    Vec3 orig = ray.origin();
+    Vec3 dir = ray.direction();
+    Vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+    bool dir_neg[3] = { inv_dir.x() < 0.0f, inv_dir.y() < 0.0f, inv_dir.z() < 0.0f };
+
+    uint32_t stack[max_depth];
+    int sp = 0;
+    uint32_t current = 0;
+
+    while (true) {
+        const BVHFlatNode &node = nodes[current];
+        STAT_INC_TO(stats, nodes_visited);
+        if (slab_hit(node.bmin, node.bmax, orig, inv_dir, tmin, tmax)) {
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count; ++i) {
+                    STAT_INC_TO(stats, primitive_tests);
+                    if (leaf_occluded(i, ray, tmin, tmax)) {
+                        return true;
+                    }
+                }
+                if (sp == 0) break;
+                current = stack[--sp];
+            } else if (dir_neg[node.axis]) {
+                stack[sp++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[sp++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (sp == 0) break;
+            current = stack[--sp];
+        }
+    }
+
+    return false;
+}
+
+template<typename LeafOccluded>
+uint32_t BVHTree::occluded_packet(RayPacket &packet, float tmin, LeafOccluded leaf_occluded) const
+{
+    if (n_nodes == 0) {
+        return 0;
+    }
+
+    STAT_BIND(stats);
+    uint32_t stack[max_depth];
+    int sp = 0;
+    uint32_t current = 0;
+    uint32_t blocked = 0;
+
+    while (packet.active()) {
+        const BVHFlatNode &node = nodes[current];
+        STAT_INC_TO(stats, nodes_visited);
+        uint32_t mask = 0;
+        if (packet.may_hit(node.bmin, node.bmax, tmin)) {
+            mask = packet.hit_mask(node.bmin, node.bmax, tmin);
+        }
+
+        if (mask) {
+            if (node.count > 0) {
+                for (uint32_t i = node.offset; i < node.offset + node.count && mask; ++i) {
+                    for (int k = 0; k < RayPacket::size; ++k) {
+                        if (!(mask >> k & 1)) {
+                            continue;
+                        }
+                        STAT_INC_TO(stats, primitive_tests);
+                        if (leaf_occluded(i, packet.ray(k), tmin, packet.tmax(k))) {
+                            blocked |= 1u << k;
+                            mask &= ~(1u << k);
+                            packet.retire(k);
+                        }
+                    }
+                }
+                if (sp == 0) break;
+                current = stack[--sp];
+            } else if (packet.direction_negative(node.axis)) {
+                stack[sp++] = current + 1;
+                current = node.offset;
+            } else {
+                stack[sp++] = node.offset;
+                current = current + 1;
+            }
+        } else {
+            if (sp == 0) break;
+            current = stack[--sp];
+        }
+    }
+
+    return blocked;
+}
+
+// split hitables into the ones with a bounding box and their boxes
+void collect_bounded(const std::vector<Hitable *> &hitables, std::vector<Hitable *> &bounded, std::vector<AABB> &boxes);
+
+// map the tree from `cache_dir` when a matching one exists, build (and
+// store) it otherwise; returns true on a cache hit
+bool load_or_build(BVHTree &tree, const std::vector<AABB> &boxes, const BVHSettings &settings, const char *cache_dir);
+
+// BVH over Hitables, optionally persisted in `cache_dir` so that later runs
+// over the same primitives map the tree instead of building it
+class LinearBVH : public Hitable
+{
+public:
+    LinearBVH(const std::vector<Hitable *> &hitables, const BVHSettings &settings = BVHSettings(),
+              const char *cache_dir = nullptr);
+
+    virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override
+    {
+        return tree.hit(ray, tmin, tmax, hit,
+            [this](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+                return prims[i]->hit(r, t0, t1, h);
+            });
+    }
+
+    // packets whose rays go in different octants are traced ray by ray
+    virtual uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits) const override
+    {
+        if (!packet.is_coherent()) {
+            return Hitable::hit_packet(packet, tmin, hits);
+        }
+        return tree.hit_packet(packet, tmin, hits,
+            [this](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+                return prims[i]->hit(r, t0, t1, h);
+            });
+    }
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override
+    {
+        return tree.occluded(ray, tmin, tmax,
+            [this](uint32_t i, const Ray &r, float t0, float t1) {
+                return prims[i]->occluded(r, t0, t1);
+            });
+    }
+
+    virtual uint32_t occluded_packet(RayPacket &packet, float tmin) const override
+    {
+        if (!packet.is_coherent()) {
+            return Hitable::occluded_packet(packet, tmin);
+        }
+        return tree.occluded_packet(packet, tmin,
+            [this](uint32_t i, const Ray &r, float t0, float t1) {
+                return prims[i]->occluded(r, t0, t1);
+            });
+    }
+
+    virtual bool bounding_box(AABB &box) const override
+    {
+        return tree.bounds(box);
+    }
+
+    bool loaded_from_cache() const { return cached; }
+
+private:
+    // primitives in leaf order
+    std::vector<Hitable *> prims;
+    BVHTree tree;
+    bool cached;
+};
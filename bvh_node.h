@@ -71,6 +71,11 @@ public:
             return false;
         }
     }
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override
+    {
+        return box.hit(ray, tmin, tmax) && (left->occluded(ray, tmin, tmax) || right->occluded(ray, tmin, tmax));
+    }
    
     virtual bool bounding_box(AABB &_box) const override
     {
@@ -24,9 +24,9 @@ void Camera::setup(float hfov, float aspect)
 
 void Camera::look_at(const Vec3 &from, const Vec3 &to, const Vec3 &up)
 {
-    origin = from;
-    cz = unit_vector(from - to);
-    cx = unit_vector(cross(up, cz));
+    origin = Vec3A(from);
+    cz = Vec3A(unit_vector(from - to));
+    cx = unit_vector(cross(Vec3A(up), cz));
     cy = cross(cz, cx);
 
     update_internals();
@@ -40,16 +40,9 @@ void Camera::set_lens(float aperture, float _focus_dist)
     update_internals();
 }
 
-Ray Camera::get_ray(float u, float v) const
-{
-    Vec3 rd = lens_radius * random_in_unit_disk(); 
-    Vec3 offset = rd.x() * cx + rd.y() * cy;
-    return Ray(origin + offset, lower_left_corner + u * horizontal + v * vertical - (origin + offset));
-}
-
 Vec3 Camera::project(Vec3 x) const
 {
-    Vec3 ox = x - origin;
+    Vec3A ox = Vec3A(x) - origin;
     Vec3 xc(dot(cx, ox), dot(cy, ox), dot(cz, ox));
     Vec3 xp(xc.x() / -xc.z(), xc.y() / -xc.z(), -xc.z());
     return (xp + Vec3(half_width, half_height, 0.0)) / Vec3(2 * half_width, 2 * half_height, 1.0);
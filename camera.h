@@ -1,8 +1,9 @@
 #pragma once
 
 #include "vec3.h"
-
-class Ray;
+#include "simd.h"
+#include "ray.h"
+#include "utils.h"
 
 class Camera
 {
@@ -17,22 +18,39 @@ public:
   
     void set_lens(float aperture, float _focus_dist);
   
-    Ray get_ray(float u, float v) const;
+    // inline so that the lens samples come from the caller's generator
+    Ray get_ray(float u, float v) const
+    {
+        Vec3 rd = lens_radius * random_in_unit_disk();
+        Vec3A o = origin + rd.x() * cx + rd.y() * cy;
+        return Ray(o, lower_left_corner + u * horizontal + v * vertical - o);
+    }
   
     Vec3 project(Vec3 x) const;
 
+    // angle subtended by a pixel of an image `height` pixels high
+    float pixel_spread(int height) const { return 2.0f * atanf(half_height) / height; }
+
+    // change of the (unnormalized) direction of get_ray() from one pixel to
+    // the next, right and down; the origin does not change
+    void pixel_differentials(int width, int height, Vec3 &ddx, Vec3 &ddy) const
+    {
+        ddx = (horizontal / float(width)).to_vec3();
+        ddy = (vertical / -float(height)).to_vec3();
+    }
+
 private:
     void update_internals();
  
     float half_width;
     float half_height;
-    Vec3 lower_left_corner;
-    Vec3 horizontal;
-    Vec3 vertical;
-    Vec3 origin;
+    Vec3A lower_left_corner;
+    Vec3A horizontal;
+    Vec3A vertical;
+    Vec3A origin;
     float lens_radius;
     float focus_dist;
-    Vec3 cz;
-    Vec3 cx;
-    Vec3 cy;
+    Vec3A cz;
+    Vec3A cx;
+    Vec3A cy;
 };
@@ -0,0 +1,107 @@
+#include "environment.h"
+#include "utils.h"
+
+#include <algorithm>
+
+namespace {
+
+float luminance(const Vec3 &c)
+{
+    return 0.2126f * c.r() + 0.7152f * c.g() + 0.0722f * c.b();
+}
+
+// index k such that cdf[k] <= x < cdf[k + 1], over n intervals
+int find_interval(const float *cdf, int n, float x)
+{
+    int k = int(std::upper_bound(cdf, cdf + n + 1, x) - cdf) - 1;
+    return clamp(k, 0, n - 1);
+}
+
+} // namespace
+
+LatLongEnvironment::LatLongEnvironment(const float *data, int _width, int _height, int nc, float intensity)
+: width(_width), height(_height), pixels(_width * _height),
+  conditional_cdf((_width + 1) * _height), marginal_cdf(_height + 1)
+{
+    for (int k = 0; k < width * height; ++k) {
+        const float *p = data + nc * k;
+        pixels[k] = intensity * (nc >= 3 ? Vec3(p[0], p[1], p[2]) : Vec3(p[0]));
+    }
+
+    // rows near the poles cover a smaller solid angle
+    marginal_cdf[0] = 0.0f;
+    for (int j = 0; j < height; ++j) {
+        float latitude = M_PI / 2.0 - M_PI * (j + 0.5f) / height;
+        float row_scale = cos(latitude);
+        float *cdf = &conditional_cdf[j * (width + 1)];
+        cdf[0] = 0.0f;
+        for (int i = 0; i < width; ++i) {
+            cdf[i + 1] = cdf[i] + row_scale * luminance(pixels[j * width + i]);
+        }
+        marginal_cdf[j + 1] = marginal_cdf[j] + cdf[width];
+    }
+}
+
+void LatLongEnvironment::direction_to_pixel(const Vec3 &direction, int &i, int &j) const
+{
+    Vec3 d = unit_vector(direction);
+    float phi = atan2(d.z(), d.x());
+    float theta = asin(clamp(d.y(), -1.0f, 1.0f));
+    float u = 1.0 - (phi + M_PI) / (2.0 * M_PI);
+    float v = (theta + M_PI / 2.0) / M_PI;
+    i = clamp(int(u * width), 0, width - 1);
+    j = clamp(int((1.0f - v) * height), 0, height - 1);
+}
+
+Vec3 LatLongEnvironment::value(const Vec3 &direction) const
+{
+    int i, j;
+    direction_to_pixel(direction, i, j);
+    return pixels[j * width + i];
+}
+
+Vec3 LatLongEnvironment::sample(float u1, float u2, float &pdf) const
+{
+    float total = marginal_cdf[height];
+    if (total <= 0.0f) {
+        return Environment::sample(u1, u2, pdf);
+    }
+
+    float x = u1 * total;
+    int j = find_interval(marginal_cdf.data(), height, x);
+    float row_weight = marginal_cdf[j + 1] - marginal_cdf[j];
+    float dv = (x - marginal_cdf[j]) / row_weight;
+
+    const float *cdf = &conditional_cdf[j * (width + 1)];
+    float y = u2 * cdf[width];
+    int i = find_interval(cdf, width, y);
+    float pixel_weight = cdf[i + 1] - cdf[i];
+    float du = pixel_weight > 0.0f ? (y - cdf[i]) / pixel_weight : 0.5f;
+
+    float u = (i + du) / width;
+    float v = 1.0f - (j + dv) / height;
+    float phi = (1.0f - u) * 2.0 * M_PI - M_PI;
+    float latitude = v * M_PI - M_PI / 2.0;
+    float cos_lat = cos(latitude);
+
+    // density over the image is piecewise constant, dw = cos(lat) 2 pi^2 du dv
+    float pdf_uv = pixel_weight / total * (width * height);
+    pdf = cos_lat > 0.0f ? pdf_uv / (2.0f * M_PI * M_PI * cos_lat) : 0.0f;
+
+    return Vec3(cos_lat * cos(phi), sin(latitude), cos_lat * sin(phi));
+}
+
+float LatLongEnvironment::pdf(const Vec3 &direction) const
+{
+    float total = marginal_cdf[height];
+    if (total <= 0.0f) {
+        return Environment::pdf(direction);
+    }
+
+    int i, j;
+    direction_to_pixel(direction, i, j);
+    const float *cdf = &conditional_cdf[j * (width + 1)];
+    float pdf_uv = (cdf[i + 1] - cdf[i]) / total * (width * height);
+    float cos_lat = sqrt(fmax(0.0f, 1.0f - unit_vector(direction).y() * unit_vector(direction).y()));
+    return cos_lat > 0.0f ? pdf_uv / (2.0f * M_PI * M_PI * cos_lat) : 0.0f;
+}
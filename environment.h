@@ -0,0 +1,88 @@
+#pragma once
+
+#include "vec3.h"
+
+#include <math.h>
+#include <vector>
+
+// Radiance arriving from infinitely far away, looked up when a ray leaves
+// the scene instead of intersecting a sky sphere
+class Environment
+{
+public:
+    virtual ~Environment() = default;
+
+    virtual Vec3 value(const Vec3 &direction) const = 0;
+
+    // draw a unit direction, roughly in proportion to the radiance, and
+    // return its solid angle density; the default is uniform
+    virtual Vec3 sample(float u1, float u2, float &pdf) const
+    {
+        float y = 1.0f - 2.0f * u1;
+        float r = sqrt(fmax(0.0f, 1.0f - y * y));
+        float phi = 2.0f * M_PI * u2;
+        pdf = 1.0f / (4.0f * M_PI);
+        return Vec3(r * cos(phi), y, r * sin(phi));
+    }
+
+    virtual float pdf(const Vec3 &direction) const
+    {
+        return 1.0f / (4.0f * M_PI);
+    }
+};
+
+class ConstantEnvironment : public Environment
+{
+public:
+    ConstantEnvironment(const Vec3 &_color) : color(_color) { }
+
+    virtual Vec3 value(const Vec3 &direction) const override
+    {
+        return color;
+    }
+
+private:
+    Vec3 color;
+};
+
+// Vertical blend between the colors seen straight up and straight down
+class GradientEnvironment : public Environment
+{
+public:
+    GradientEnvironment(const Vec3 &_top, const Vec3 &_bottom) : top(_top), bottom(_bottom) { }
+
+    virtual Vec3 value(const Vec3 &direction) const override
+    {
+        float t = 0.5 * (unit_vector(direction).y() + 1.0);
+        return mix(top, bottom, t);
+    }
+
+private:
+    Vec3 top;
+    Vec3 bottom;
+};
+
+// Equirectangular map using the same (u, v) convention as Sphere::get_uv,
+// importance sampled through a 2D CDF of the pixel luminance
+class LatLongEnvironment : public Environment
+{
+public:
+    LatLongEnvironment(const float *data, int _width, int _height, int nc, float intensity = 1.0);
+
+    virtual Vec3 value(const Vec3 &direction) const override;
+
+    virtual Vec3 sample(float u1, float u2, float &pdf) const override;
+
+    virtual float pdf(const Vec3 &direction) const override;
+
+private:
+    void direction_to_pixel(const Vec3 &direction, int &i, int &j) const;
+
+    int width;
+    int height;
+    std::vector<Vec3> pixels;
+    // per row cumulative weights over the columns (width + 1 entries each)
+    std::vector<float> conditional_cdf;
+    // cumulative row weights (height + 1 entries)
+    std::vector<float> marginal_cdf;
+};
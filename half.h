@@ -0,0 +1,56 @@
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+
+// IEEE 754 binary16 conversions, for texels that need more range or
+// precision than 8 bits without the size of floats
+
+// rounds to nearest even; too large values become infinities
+inline uint16_t float_to_half(float f)
+{
+    uint32_t x;
+    memcpy(&x, &f, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    uint32_t a = x & 0x7fffffff;
+
+    if (a >= 0x7f800000) {
+        // infinity, or a quiet NaN
+        return sign | 0x7c00 | (a > 0x7f800000 ? 0x200 : 0);
+    }
+    if (a >= 0x477ff000) {
+        // 65520 and up round past the largest half
+        return sign | 0x7c00;
+    }
+    if (a < 0x38800000) {
+        // below the smallest normal half, the result counts units of 2^-24
+        float magnitude;
+        memcpy(&magnitude, &a, sizeof(magnitude));
+        return sign | uint16_t(lrintf(magnitude * 16777216.0f));
+    }
+
+    // rebias the exponent from 127 to 15, then round off 13 mantissa bits;
+    // a carry into the exponent is still the right result
+    uint32_t h = a - 0x38000000;
+    h += 0xfff + ((h >> 13) & 1);
+    return sign | (h >> 13);
+}
+
+inline float half_to_float(uint16_t h)
+{
+    uint32_t sign = uint32_t(h & 0x8000) << 16;
+    uint32_t exponent = (h >> 10) & 0x1f;
+    uint32_t mantissa = h & 0x3ff;
+
+    if (exponent == 0) {
+        float f = mantissa * (1.0f / 16777216.0f);
+        return sign ? -f : f;
+    }
+
+    uint32_t x = sign | (mantissa << 13);
+    x |= exponent == 31 ? 0x7f800000 : (exponent + 112) << 23;
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
@@ -2,7 +2,10 @@
 
 #include "vec3.h"
 #include "aabb.h"
+#include "packet.h"
 
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
 class Ray;
@@ -16,8 +19,24 @@ struct Hit
     Vec3 p;
     Vec3 normal;
     float u, v;
+    // derivatives of p along the surface, set along with (u, v) and zero
+    // when they are not computed
+    Vec3 dpdu, dpdv;
+    // of the surface along the normal, 1 / radius for spheres; the normal
+    // changes by curvature * dp
+    float curvature;
+    // set by the integrator for texture filtering: derivatives of (u, v)
+    // from one pixel to the next, and width of the pixel footprint
+    float dudx, dvdx, dudy, dvdy;
+    float footprint;
     float t;
     Material *material;
+
+    // width of the footprint in uv units
+    float uv_footprint() const
+    {
+        return std::max(std::sqrt(dudx * dudx + dvdx * dvdx), std::sqrt(dudy * dudy + dvdy * dvdy));
+    }
 };
 
 class Hitable
@@ -26,6 +45,44 @@ public:
     virtual ~Hitable() = default;
 
     virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const = 0;
+
+    // traces all the rays of a packet: bit i of the result is set when
+    // lane i hit, in hits[i], and the lane's tmax is lowered to the hit;
+    // hitables with a packet traversal override this
+    virtual uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits) const
+    {
+        uint32_t mask = 0;
+        for (int i = 0; i < RayPacket::size; ++i) {
+            if ((packet.active() >> i & 1) && hit(packet.ray(i), tmin, packet.tmax(i), hits[i])) {
+                packet.shorten(i, hits[i].t);
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
+
+    // true when something lies on `ray` between tmin and tmax, as for
+    // shadow rays; any hit will do, hitables with a traversal stop at the
+    // first one
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const
+    {
+        Hit blocker;
+        return hit(ray, tmin, tmax, blocker);
+    }
+
+    // the same for the lanes of a packet: bit i of the result is set when
+    // lane i is occluded, and the lane is then retired from the packet
+    virtual uint32_t occluded_packet(RayPacket &packet, float tmin) const
+    {
+        uint32_t mask = 0;
+        for (int i = 0; i < RayPacket::size; ++i) {
+            if ((packet.active() >> i & 1) && occluded(packet.ray(i), tmin, packet.tmax(i))) {
+                packet.retire(i);
+                mask |= 1u << i;
+            }
+        }
+        return mask;
+    }
    
     // return false if the object is not bounded
     virtual bool bounding_box(AABB &box) const = 0;
@@ -59,6 +116,16 @@ public:
         return got_hit;
     }
 
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override
+    {
+        for (Hitable *e : elems) {
+            if (e->occluded(ray, tmin, tmax)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
     virtual bool bounding_box(AABB &box) const override
     {
         if (elems.empty()) return false;
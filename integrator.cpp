@@ -0,0 +1,661 @@
+#include "integrator.h"
+#include "material.h"
+#include "utils.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+#include <vector>
+
+static_assert(Material::DIFFUSE_LIGHT + 1 == RenderStats::n_material_kinds, "one shading counter per material kind");
+
+namespace {
+
+const float ray_epsilon = 0.001;
+
+// paths in flight per thread in the wavefront mode
+const int wavefront_size = 1 << 12;
+
+// spread of the ray cone after a diffuse bounce
+const float diffuse_spread = 0.5;
+
+inline float power_heuristic(float pdf, float other_pdf)
+{
+    return (pdf * pdf) / (pdf * pdf + other_pdf * other_pdf);
+}
+
+// Direct lighting from the environment at a diffuse hit, sampled from the
+// environment and weighted against the cosine sampling of the next bounce.
+// Returns the unoccluded contribution and the ray that must escape.
+bool sample_environment(const Scene &world, const Hit &hit, Ray &shadow_ray, Vec3 &contribution)
+{
+    const Environment *env = world.get_environment();
+    float light_pdf;
+    Vec3 wi = env->sample(random_in_0_1(), random_in_0_1(), light_pdf);
+    float cosine = dot(wi, hit.normal);
+    if (light_pdf <= 0.0 || cosine <= 0.0) {
+        return false;
+    }
+
+    float bsdf_pdf = cosine / M_PI;
+    shadow_ray = Ray(hit.p, wi);
+    contribution = (power_heuristic(light_pdf, bsdf_pdf) * bsdf_pdf / light_pdf) * env->value(wi);
+    return true;
+}
+
+inline void start_path(PathState &path, const Ray &r, const PixelFootprint &footprint, uint32_t pixel)
+{
+    path.ray = r;
+    path.throughput = Vec3(1.0);
+    path.radiance = Vec3(0.0);
+    path.bsdf_pdf = 0.0;
+    path.cone_width = 0.0;
+    path.cone_spread = footprint.spread;
+    path.differentials = footprint.differentials;
+    if (footprint.differentials) {
+        // derivatives of the unit direction
+        Vec3 d = r.direction();
+        float length = d.length();
+        d /= length;
+        path.dodx = path.dody = Vec3(0.0);
+        path.dddx = (footprint.ddx - dot(d, footprint.ddx) * d) / length;
+        path.dddy = (footprint.ddy - dot(d, footprint.ddy) * d) / length;
+    }
+    path.depth = 0;
+    path.pixel = pixel;
+}
+
+// Sets the footprint of `hit` and the derivatives of its (u, v). With ray
+// differentials they come from where the offset rays meet the tangent
+// plane, and the offsets of p are returned for the next bounce; otherwise
+// from the ray cone, which grows linearly and ignores the slant of the
+// surface, the filter is isotropic then.
+void set_footprint(const PathState &path, Hit &hit, Vec3 &dpdx, Vec3 &dpdy)
+{
+    bool found = false;
+    if (path.differentials) {
+        Vec3 o = path.ray.origin();
+        Vec3 d = unit_vector(path.ray.direction());
+        float plane = dot(hit.normal, hit.p);
+        Vec3 dx = d + path.dddx;
+        Vec3 dy = d + path.dddy;
+        float tx = (plane - dot(hit.normal, o + path.dodx)) / dot(hit.normal, dx);
+        float ty = (plane - dot(hit.normal, o + path.dody)) / dot(hit.normal, dy);
+        dpdx = o + path.dodx + tx * dx - hit.p;
+        dpdy = o + path.dody + ty * dy - hit.p;
+        // an offset ray can run parallel to the plane
+        found = std::isfinite(tx) && std::isfinite(ty);
+    }
+
+    if (!found) {
+        float width = path.cone_width + path.cone_spread * hit.t * path.ray.direction().length();
+        // over the mean stretch of the mapping
+        float area = cross(hit.dpdu, hit.dpdv).length();
+        float uv_width = area > 0.0f ? width / std::sqrt(area) : 0.0f;
+        hit.footprint = width;
+        hit.dudx = hit.dvdy = uv_width;
+        hit.dvdx = hit.dudy = 0.0;
+        dpdx = dpdy = Vec3(0.0);
+        return;
+    }
+
+    hit.footprint = std::max(dpdx.length(), dpdy.length());
+
+    // least squares solution of dp = dpdu du + dpdv dv
+    float a = dot(hit.dpdu, hit.dpdu);
+    float b = dot(hit.dpdu, hit.dpdv);
+    float c = dot(hit.dpdv, hit.dpdv);
+    float det = a * c - b * b;
+    if (det > 1e-8f * a * c) {
+        hit.dudx = (c * dot(hit.dpdu, dpdx) - b * dot(hit.dpdv, dpdx)) / det;
+        hit.dvdx = (a * dot(hit.dpdv, dpdx) - b * dot(hit.dpdu, dpdx)) / det;
+        hit.dudy = (c * dot(hit.dpdu, dpdy) - b * dot(hit.dpdv, dpdy)) / det;
+        hit.dvdy = (a * dot(hit.dpdv, dpdy) - b * dot(hit.dpdu, dpdy)) / det;
+    } else {
+        hit.dudx = hit.dvdx = hit.dudy = hit.dvdy = 0.0;
+    }
+}
+
+// derivative of the mirror direction r = d - 2 (d.n) n of the unit vector d
+inline Vec3 reflect_differential(const Vec3 &d, const Vec3 &n, const Vec3 &dd, const Vec3 &dn)
+{
+    return dd - 2.0f * (dot(d, n) * dn + (dot(dd, n) + dot(d, dn)) * n);
+}
+
+// derivative of the refracted direction t = eta d + (eta c - sqrt(k)) n,
+// where c = -d.n and k = 1 - eta^2 (1 - c^2), for n facing d
+inline Vec3 refract_differential(const Vec3 &d, const Vec3 &n, float eta, const Vec3 &dd, const Vec3 &dn)
+{
+    float c = -dot(d, n);
+    float root = std::sqrt(std::max(1.0f - eta * eta * (1.0f - c * c), 1e-6f));
+    float dc = -(dot(dd, n) + dot(d, dn));
+    float droot = eta * eta * c * dc / root;
+    return eta * dd + (eta * dc - droot) * n + (eta * c - root) * dn;
+}
+
+// Carries the footprint over to the scattered ray: the differentials
+// follow mirror reflections and refractions, other bounces widen the cone
+// instead (a diffuse bounce by a rough guess of the lobe width, since the
+// textures seen in indirect light are averaged anyway).
+void propagate_footprint(PathState &path, const Hit &hit, const Ray &scattered, const Vec3 &dpdx, const Vec3 &dpdy)
+{
+    const Material *material = hit.material;
+    bool specular = material->kind() == Material::DIELECTRIC
+                 || (material->kind() == Material::METAL && material->roughness() == 0.0f);
+
+    if (path.differentials && specular) {
+        Vec3 d = unit_vector(path.ray.direction());
+        Vec3 n = hit.normal;
+        Vec3 dndx = hit.curvature * dpdx;
+        Vec3 dndy = hit.curvature * dpdy;
+        path.dodx = dpdx;
+        path.dody = dpdy;
+        // a reflected ray leaves on the side it came from
+        if (dot(scattered.direction(), n) * dot(d, n) < 0.0f) {
+            path.dddx = reflect_differential(d, n, path.dddx, dndx);
+            path.dddy = reflect_differential(d, n, path.dddy, dndy);
+        } else {
+            float sign = dot(d, n) > 0.0f ? -1.0f : 1.0f;
+            float eta = sign > 0.0f ? 1.0f / material->ior() : material->ior();
+            path.dddx = refract_differential(d, sign * n, eta, path.dddx, sign * dndx);
+            path.dddy = refract_differential(d, sign * n, eta, path.dddy, sign * dndy);
+        }
+    } else {
+        path.differentials = false;
+        if (material->kind() == Material::LAMBERTIAN) {
+            path.cone_spread = std::max(path.cone_spread, diffuse_spread);
+        } else if (material->kind() == Material::METAL) {
+            path.cone_spread += 2.0f * material->roughness();
+        }
+    }
+    path.cone_width = hit.footprint;
+}
+
+// follows a path whose current ray was already intersected, adds the
+// rays it traces to `rays`
+void finish_path(const Scene &world, PathState &path, bool found, Hit &hit, uint64_t &rays)
+{
+    STAT_BIND(stats);
+    for (;;) {
+        if (!found) {
+            shade_miss(world, path);
+            break;
+        }
+
+        ShadowRay shadow;
+        bool cast_shadow;
+        bool alive = shade_hit(world, hit, path, shadow, cast_shadow);
+        if (cast_shadow) {
+            rays++;
+            STAT_INC_TO(stats, rays[RenderStats::SHADOW_RAY]);
+            if (!world.occluded(shadow.ray, ray_epsilon, std::numeric_limits<float>::max())) {
+                path.radiance += shadow.contribution;
+            }
+        }
+        if (!alive) {
+            break;
+        }
+
+        rays++;
+        STAT_INC_TO(stats, rays[RenderStats::BOUNCE_RAY]);
+        found = world.hit(path.ray, ray_epsilon, std::numeric_limits<float>::max(), hit);
+    }
+}
+
+// spreads the low 4 bits of x three bits apart
+inline uint32_t spread_bits(uint32_t x)
+{
+    x &= 0xf;
+    x = (x | (x << 4)) & 0x0c3;
+    x = (x | (x << 2)) & 0x249;
+    return x;
+}
+
+// Reorders the paths by direction octant, then by the Morton code of their
+// origin on a 16^3 grid over the bounds of the queue, so that neighbouring
+// paths start close to each other and go the same way through the BVH. The
+// 15 bit keys are sorted in two counting passes, a comparison sort costs
+// more than the traversal gains.
+void sort_paths(std::vector<PathState> &paths, std::vector<uint32_t> &keys, std::vector<uint32_t> &order,
+                std::vector<PathState> &sorted)
+{
+    size_t n = paths.size();
+    if (n < 2) {
+        return;
+    }
+
+    Vec3 lo = paths[0].ray.origin();
+    Vec3 hi = lo;
+    for (const PathState &path : paths) {
+        Vec3 o = path.ray.origin();
+        for (int a = 0; a < 3; ++a) {
+            lo[a] = fast_min(lo[a], o[a]);
+            hi[a] = fast_max(hi[a], o[a]);
+        }
+    }
+
+    Vec3 scale;
+    for (int a = 0; a < 3; ++a) {
+        scale[a] = hi[a] > lo[a] ? 15.0f / (hi[a] - lo[a]) : 0.0f;
+    }
+
+    keys.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        Vec3 o = paths[k].ray.origin();
+        Vec3 d = paths[k].ray.direction();
+        uint32_t octant = (d.x() < 0.0f) | (d.y() < 0.0f) << 1 | (d.z() < 0.0f) << 2;
+        uint32_t morton = spread_bits(uint32_t((o.x() - lo.x()) * scale.x()))
+                        | spread_bits(uint32_t((o.y() - lo.y()) * scale.y())) << 1
+                        | spread_bits(uint32_t((o.z() - lo.z()) * scale.z())) << 2;
+        keys[k] = octant << 12 | morton;
+    }
+
+    // low byte then high byte, both passes are stable
+    order.resize(2 * n);
+    uint32_t *first = &order[0];
+    uint32_t *second = &order[n];
+    for (int shift = 0; shift < 16; shift += 8) {
+        uint32_t offsets[256] = { 0 };
+        for (size_t k = 0; k < n; ++k) {
+            offsets[keys[k] >> shift & 0xff]++;
+        }
+        uint32_t sum = 0;
+        for (int b = 0; b < 256; ++b) {
+            uint32_t count = offsets[b];
+            offsets[b] = sum;
+            sum += count;
+        }
+        for (size_t k = 0; k < n; ++k) {
+            uint32_t i = shift == 0 ? k : first[k];
+            second[offsets[keys[i] >> shift & 0xff]++] = i;
+        }
+        std::swap(first, second);
+    }
+
+    sorted.resize(n);
+    for (size_t k = 0; k < n; ++k) {
+        sorted[k] = paths[first[k]];
+    }
+    std::swap(paths, sorted);
+}
+
+} // namespace
+
+bool shade_hit(const Scene &world, Hit &hit, PathState &path, ShadowRay &shadow, bool &cast_shadow)
+{
+    cast_shadow = false;
+    STAT_INC(shading_calls[hit.material->kind()]);
+
+    Vec3 dpdx, dpdy;
+    set_footprint(path, hit, dpdx, dpdy);
+
+    path.radiance += path.throughput * hit.material->emitted(hit);
+
+    Ray scattered;
+    Vec3 attenuation;
+    if (path.depth >= max_depth || !hit.material->scatter(path.ray, hit, attenuation, scattered)) {
+        STAT_INC(path_lengths[std::min(path.depth, RenderStats::n_path_lengths - 1)]);
+        return false;
+    }
+
+    Vec3 albedo;
+    if (world.get_environment() && hit.material->diffuse(hit, albedo)) {
+        Vec3 contribution;
+        if (sample_environment(world, hit, shadow.ray, contribution)) {
+            shadow.contribution = path.throughput * albedo * contribution;
+            shadow.pixel = path.pixel;
+            cast_shadow = true;
+        }
+        path.bsdf_pdf = dot(unit_vector(scattered.direction()), hit.normal) / M_PI;
+    } else {
+        path.bsdf_pdf = 0.0;
+    }
+
+    propagate_footprint(path, hit, scattered, dpdx, dpdy);
+
+    path.throughput *= attenuation;
+    path.ray = scattered;
+    path.depth++;
+    return true;
+}
+
+void shade_miss(const Scene &world, PathState &path)
+{
+    STAT_INC(misses);
+    STAT_INC(path_lengths[std::min(path.depth, RenderStats::n_path_lengths - 1)]);
+    Vec3 radiance = world.background(path.ray);
+    if (path.bsdf_pdf > 0.0 && world.get_environment()) {
+        radiance *= power_heuristic(path.bsdf_pdf, world.get_environment()->pdf(path.ray.direction()));
+    }
+    path.radiance += path.throughput * radiance;
+}
+
+Vec3 trace_ray(const Ray &r, const Scene &world, const PixelFootprint &footprint)
+{
+    PathState path;
+    start_path(path, r, footprint, 0);
+
+    Hit hit;
+    uint64_t rays = 1;
+    bool found = world.hit(r, ray_epsilon, std::numeric_limits<float>::max(), hit);
+    finish_path(world, path, found, hit, rays);
+    return path.radiance;
+}
+
+namespace {
+
+// the same for n <= RayPacket::size rays whose first hits are found with a
+// packet traversal, which pays off for coherent rays such as camera rays;
+// the bounce count of each path goes to `depths`
+void trace_packet(const Ray *rays, int n, const PixelFootprint &footprint, const Scene &world, Vec3 *radiance,
+                  int *depths, uint64_t &n_rays)
+{
+    RayPacket packet(rays, n, std::numeric_limits<float>::max());
+    Hit hits[RayPacket::size];
+    uint32_t found = world.hit_packet(packet, ray_epsilon, hits);
+    n_rays += n;
+    STAT_ADD(rays[RenderStats::CAMERA_RAY], n);
+
+    for (int k = 0; k < n; ++k) {
+        PathState path;
+        start_path(path, rays[k], footprint, 0);
+        finish_path(world, path, found >> k & 1, hits[k], n_rays);
+        radiance[k] = path.radiance;
+        depths[k] = path.depth;
+    }
+}
+
+// what a pixel has cost so far, for the debug AOVs
+struct PixelCost
+{
+    std::chrono::steady_clock::time_point start;
+    uint64_t nodes_visited;
+    uint64_t primitive_tests;
+    int depths;
+};
+
+inline void begin_pixel(DebugAOV aov, PixelCost &cost)
+{
+    cost.depths = 0;
+#ifdef RT_STATS
+    cost.nodes_visited = thread_stats.nodes_visited;
+    cost.primitive_tests = thread_stats.primitive_tests;
+#endif
+    if (aov == AOV_PIXEL_TIME) {
+        cost.start = std::chrono::steady_clock::now();
+    }
+}
+
+inline float end_pixel(DebugAOV aov, const PixelCost &cost, int ns)
+{
+    switch (aov) {
+#ifdef RT_STATS
+    case AOV_NODES_VISITED:
+        return thread_stats.nodes_visited - cost.nodes_visited;
+    case AOV_PRIMITIVE_TESTS:
+        return thread_stats.primitive_tests - cost.primitive_tests;
+#endif
+    case AOV_PATH_DEPTH:
+        return float(cost.depths) / ns;
+    case AOV_PIXEL_TIME:
+        return std::chrono::duration<float, std::micro>(std::chrono::steady_clock::now() - cost.start).count();
+    default:
+        return 0.0;
+    }
+}
+
+PixelFootprint pixel_footprint(const Camera &cam, int width, int height, const RenderSettings &settings)
+{
+    PixelFootprint footprint;
+    footprint.spread = cam.pixel_spread(height);
+    footprint.differentials = settings.differentials;
+    cam.pixel_differentials(width, height, footprint.ddx, footprint.ddy);
+    return footprint;
+}
+
+// depth-first, each path is followed to its end before the next one
+uint64_t render_paths(const Scene &world, const Camera &cam, int width, int height, int ns,
+                      const RenderSettings &settings, Vec3 *image, float *aov)
+{
+    uint64_t rays = 0;
+    PixelFootprint footprint = pixel_footprint(cam, width, height, settings);
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:rays)
+    for (int j = 0; j < height; ++j) {
+        TRACE_SCOPE("row");
+        STAT_BIND(stats);
+        seed_random(settings.seed, j);
+        for (int i = 0; i < width; ++i) {
+            PixelCost cost;
+            begin_pixel(settings.aov, cost);
+
+            Vec3 color(0.0);
+            for (int s = 0; s < ns; s += RayPacket::size) {
+                int n = std::min(int(RayPacket::size), ns - s);
+                Ray camera_rays[RayPacket::size];
+                Vec3 samples[RayPacket::size];
+                int depths[RayPacket::size];
+                for (int k = 0; k < n; ++k) {
+                    float u = float(i + random_in_0_1()) / width;
+                    float v = float(height - j + random_in_0_1()) / height;
+                    camera_rays[k] = cam.get_ray(u, v);
+                }
+
+                if (settings.packets) {
+                    trace_packet(camera_rays, n, footprint, world, samples, depths, rays);
+                } else {
+                    for (int k = 0; k < n; ++k) {
+                        PathState path;
+                        start_path(path, camera_rays[k], footprint, 0);
+                        Hit hit;
+                        rays++;
+                        STAT_INC_TO(stats, rays[RenderStats::CAMERA_RAY]);
+                        bool found = world.hit(camera_rays[k], ray_epsilon, std::numeric_limits<float>::max(), hit);
+                        finish_path(world, path, found, hit, rays);
+                        samples[k] = path.radiance;
+                        depths[k] = path.depth;
+                    }
+                }
+
+                for (int k = 0; k < n; ++k) {
+                    color += samples[k];
+                    cost.depths += depths[k];
+                }
+            }
+            image[j * width + i] = color;
+            if (aov) {
+                aov[j * width + i] = end_pixel(settings.aov, cost, ns);
+            }
+            STAT_ADD_TO(stats, samples, ns);
+            STAT_INC_TO(stats, pixels);
+        }
+    }
+
+    return rays;
+}
+
+// Breadth-first: each thread takes a band of rows, intersects all its
+// paths, groups the hits by material kind and shades every group in turn,
+// then traces the shadow rays and moves on to the next bounce
+uint64_t render_wavefront(const Scene &world, const Camera &cam, int width, int height, int ns,
+                          const RenderSettings &settings, Vec3 *image)
+{
+    const int rows_per_band = std::max(1, wavefront_size / (width * ns));
+    const int n_bands = (height + rows_per_band - 1) / rows_per_band;
+
+    // one bin per material kind, misses in the last one
+    const int n_bins = Material::DIFFUSE_LIGHT + 2;
+    const int miss_bin = n_bins - 1;
+
+    std::fill(image, image + width * height, Vec3(0.0));
+    uint64_t rays = 0;
+    PixelFootprint footprint = pixel_footprint(cam, width, height, settings);
+
+    #pragma omp parallel reduction(+:rays)
+    {
+        std::vector<PathState> paths, next;
+        std::vector<Hit> hits;
+        std::vector<uint8_t> bins;
+        std::vector<uint32_t> order;
+        std::vector<ShadowRay> shadows;
+        std::vector<uint32_t> keys, sort_order;
+        std::vector<PathState> sorted;
+
+        // bands are disjoint, so are the pixels each thread writes
+        #pragma omp for schedule(dynamic)
+        for (int band = 0; band < n_bands; ++band) {
+            TRACE_SCOPE("band");
+            STAT_BIND(stats);
+            int j_end = std::min(height, (band + 1) * rows_per_band);
+            seed_random(settings.seed, band);
+
+            paths.clear();
+            for (int j = band * rows_per_band; j < j_end; ++j) {
+                for (int i = 0; i < width; ++i) {
+                    STAT_ADD_TO(stats, samples, ns);
+                    STAT_INC_TO(stats, pixels);
+                    for (int s = 0; s < ns; ++s) {
+                        float u = float(i + random_in_0_1()) / width;
+                        float v = float(height - j + random_in_0_1()) / height;
+
+                        PathState path;
+                        start_path(path, cam.get_ray(u, v), footprint, j * width + i);
+                        paths.push_back(path);
+                    }
+                }
+            }
+
+            int bounce = 0;
+            while (!paths.empty()) {
+                size_t n = paths.size();
+                rays += n;
+                STAT_ADD_TO(stats, rays[bounce == 0 ? RenderStats::CAMERA_RAY : RenderStats::BOUNCE_RAY], n);
+
+                // intersect the whole queue, the camera rays by packets of
+                // samples of the same pixel unless settings.packets is off.
+                // Later bounces go ray by ray: once sorted, their packets
+                // share an octant but diverge in space, which costs more
+                // than single rays.
+                hits.resize(n);
+                bins.resize(n);
+                int counts[n_bins] = { 0 };
+                if (bounce == 0 && settings.packets) {
+                    TRACE_SCOPE("camera rays");
+                    for (size_t k = 0; k < n; k += RayPacket::size) {
+                        int m = std::min(int(RayPacket::size), int(n - k));
+                        Ray batch[RayPacket::size];
+                        for (int l = 0; l < m; ++l) {
+                            batch[l] = paths[k + l].ray;
+                        }
+                        RayPacket packet(batch, m, std::numeric_limits<float>::max());
+                        uint32_t found = world.hit_packet(packet, ray_epsilon, &hits[k]);
+                        for (int l = 0; l < m; ++l) {
+                            bins[k + l] = (found >> l & 1) ? hits[k + l].material->kind() : miss_bin;
+                        }
+                    }
+                } else {
+                    TRACE_SCOPE(bounce == 0 ? "camera rays" : "bounce rays");
+                    for (size_t k = 0; k < n; ++k) {
+                        bool found = world.hit(paths[k].ray, ray_epsilon, std::numeric_limits<float>::max(), hits[k]);
+                        bins[k] = found ? hits[k].material->kind() : miss_bin;
+                    }
+                }
+                for (size_t k = 0; k < n; ++k) {
+                    counts[bins[k]]++;
+                }
+
+                // counting sort of the paths by material kind
+                int offsets[n_bins];
+                offsets[0] = 0;
+                for (int b = 1; b < n_bins; ++b) {
+                    offsets[b] = offsets[b - 1] + counts[b - 1];
+                }
+                order.resize(n);
+                for (size_t k = 0; k < n; ++k) {
+                    order[offsets[bins[k]]++] = k;
+                }
+
+                // shade, each kind in one run
+                next.clear();
+                shadows.clear();
+                {
+                    TRACE_SCOPE("shade");
+                    for (size_t o = 0; o < n; ++o) {
+                        uint32_t k = order[o];
+                        PathState &path = paths[k];
+                        if (bins[k] == miss_bin) {
+                            shade_miss(world, path);
+                            image[path.pixel] += path.radiance;
+                            continue;
+                        }
+
+                        ShadowRay shadow;
+                        bool cast_shadow;
+                        bool alive = shade_hit(world, hits[k], path, shadow, cast_shadow);
+                        // what the path gathered so far is final
+                        image[path.pixel] += path.radiance;
+                        if (alive) {
+                            path.radiance = Vec3(0.0);
+                            next.push_back(path);
+                        }
+                        if (cast_shadow) {
+                            shadows.push_back(shadow);
+                        }
+                    }
+                }
+
+                rays += shadows.size();
+                STAT_ADD_TO(stats, rays[RenderStats::SHADOW_RAY], shadows.size());
+                if (settings.packets) {
+                    TRACE_SCOPE("shadow rays");
+                    for (size_t k = 0; k < shadows.size(); k += RayPacket::size) {
+                        int m = std::min(int(RayPacket::size), int(shadows.size() - k));
+                        Ray batch[RayPacket::size];
+                        for (int l = 0; l < m; ++l) {
+                            batch[l] = shadows[k + l].ray;
+                        }
+                        RayPacket packet(batch, m, std::numeric_limits<float>::max());
+                        uint32_t blocked = world.occluded_packet(packet, ray_epsilon);
+                        for (int l = 0; l < m; ++l) {
+                            if (!(blocked >> l & 1)) {
+                                image[shadows[k + l].pixel] += shadows[k + l].contribution;
+                            }
+                        }
+                    }
+                } else {
+                    TRACE_SCOPE("shadow rays");
+                    for (const ShadowRay &shadow : shadows) {
+                        if (!world.occluded(shadow.ray, ray_epsilon, std::numeric_limits<float>::max())) {
+                            image[shadow.pixel] += shadow.contribution;
+                        }
+                    }
+                }
+
+                bounce++;
+                std::swap(paths, next);
+                if (settings.sort_rays) {
+                    TRACE_SCOPE("sort rays");
+                    sort_paths(paths, keys, sort_order, sorted);
+                }
+            }
+        }
+    }
+
+    return rays;
+}
+
+} // namespace
+
+uint64_t render(const Scene &world, const Camera &cam, int width, int height, int ns,
+                const RenderSettings &settings, Vec3 *image, float *aov)
+{
+    if (settings.aov == NO_AOV) {
+        aov = nullptr;
+    }
+    if (settings.wavefront && !aov) {
+        return render_wavefront(world, cam, width, height, ns, settings, image);
+    }
+    return render_paths(world, cam, width, height, ns, settings, image, aov);
+}
@@ -0,0 +1,110 @@
+#pragma once
+
+#include "scene.h"
+#include "camera.h"
+
+#include <stdint.h>
+
+// longest path, in bounces
+const int max_depth = 10;
+
+// One path between two bounces
+struct PathState
+{
+    Ray ray;
+    // product of the attenuations so far
+    Vec3 throughput;
+    Vec3 radiance;
+    // density of `ray` when a diffuse material scattered it, 0 for camera
+    // rays and specular bounces
+    float bsdf_pdf;
+    // ray cone of the pixel footprint: width at the ray origin and spread
+    // angle, for texture filtering
+    float cone_width;
+    float cone_spread;
+    // ray differentials, the offsets of the origin and of the unit
+    // direction toward the next pixel; they follow mirror reflections and
+    // refractions, the cone takes over after other bounces
+    bool differentials;
+    Vec3 dodx, dody;
+    Vec3 dddx, dddy;
+    int depth;
+    uint32_t pixel;
+};
+
+// Direct lighting from the environment, counted if `ray` escapes the scene.
+// Emissive primitives are not sampled, paths only find them by scattering.
+struct ShadowRay
+{
+    Ray ray;
+    Vec3 contribution;
+    uint32_t pixel;
+};
+
+// Footprint of the camera rays of a pixel
+struct PixelFootprint
+{
+    PixelFootprint() : spread(0.0), differentials(false) { }
+
+    // angle of the ray cone, 0 for point sampled textures
+    float spread;
+    // with the change of direction ddx and ddy from Camera::pixel_differentials
+    bool differentials;
+    Vec3 ddx, ddy;
+};
+
+// Adds the emission at `hit` to the path and scatters it for the next
+// bounce; returns false when the path ends. At diffuse hits a shadow ray
+// toward the environment is set up and `cast_shadow` is set. The footprint
+// and the (u, v) derivatives of the hit are set from the path.
+bool shade_hit(const Scene &world, Hit &hit, PathState &path, ShadowRay &shadow, bool &cast_shadow);
+
+// adds the environment seen by a path leaving the scene
+void shade_miss(const Scene &world, PathState &path);
+
+// radiance along one camera ray, one bounce after the other
+Vec3 trace_ray(const Ray &r, const Scene &world, const PixelFootprint &footprint = PixelFootprint());
+
+// Debug outputs, one value per pixel summed over its samples. The node
+// visits and primitive tests come from the RT_STATS counters.
+enum DebugAOV
+{
+    NO_AOV,
+    AOV_NODES_VISITED,
+    AOV_PRIMITIVE_TESTS,
+    // bounces, averaged over the samples
+    AOV_PATH_DEPTH,
+    // microseconds
+    AOV_PIXEL_TIME
+};
+
+struct RenderSettings
+{
+    RenderSettings()
+    : wavefront(false), sort_rays(false), packets(true), differentials(true), seed(1), aov(NO_AOV) { }
+
+    // trace the paths breadth-first, shading the hits in batches sorted by
+    // material kind, instead of one path after the other
+    bool wavefront;
+    // with wavefront, reorder the secondary rays by direction and origin
+    // before each bounce
+    bool sort_rays;
+    // find the first hits of the samples of a pixel with a packet traversal,
+    // and with wavefront the shadow rays too
+    bool packets;
+    // filter the textures with ray differentials where they apply, rather
+    // than with ray cones only
+    bool differentials;
+    // the random numbers of each row (or band of rows) start from this
+    // seed, so that images do not depend on the thread count
+    uint32_t seed;
+    // the cost of a pixel can only be told when its samples are traced
+    // together, the wavefront mode is not used with an AOV
+    DebugAOV aov;
+};
+
+// Renders `ns` samples per pixel and stores their sum in `image`, and the
+// settings.aov of each pixel in `aov`; returns the number of rays traced,
+// shadow rays included
+uint64_t render(const Scene &world, const Camera &cam, int width, int height, int ns,
+                const RenderSettings &settings, Vec3 *image, float *aov = nullptr);
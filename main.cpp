@@ -11,20 +11,42 @@
 #include "camera.h"
 #include "material.h"
 #include "utils.h"
-#include "bvh_node.h"
+#include "scene.h"
+#include "plane.h"
+#include "environment.h"
+#include "mesh.h"
+#include "obj_loader.h"
+#include "mesh_file.h"
+#include "texture_file.h"
 #include "texture.h"
 #include "object_frame.h"
-
+#include "scene_file.h"
+#include "integrator.h"
+#include "stats.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
 #include <limits>
 #include <iomanip>
 #include <sstream>
+#include <string.h>
+#include <omp.h>
 
-Vec3 background(const Ray &r)
-{
-    Vec3 unit_direction = unit_vector(r.direction());
-    float t = 0.5 * (unit_direction.y() + 1.0);
-    return mix(Vec3(0.5, 0.7, 1.0), Vec3(1.0, 1.0, 1.0), t);
-}
+// trees of static scenes are kept here and reused by later runs
+const char *bvh_cache_dir = "bvh_cache";
+
+// quantized 4-wide nodes take about a third of the memory of the binary
+// tree, which pays off once the tree no longer fits in the caches
+bool quantized_bvh = false;
+
+// checker textures take the sign of sin(y) along with sin(x) and sin(z), so
+// the checkered ground planes sit just below y = 0: on it, the sign would be
+// rounding noise
+const Vec3 checker_ground(0.0, -1e-3, 0.0);
+
+RenderSettings render_settings;
 
 void draw_line(uint8_t *img_data, int width, int height, float x0, float y0, float x1, float y1, Vec3 color)
 {
@@ -74,36 +96,65 @@ void draw_world_axis(uint8_t *img_data, int width, int height, const Camera &cam
     draw_line(img_data, width, height, O.x(), height-O.y(), Z.x(), height-Z.y(), Vec3(0.0, 0.0, length));
 }
 
-inline Vec3 trace_ray(const Ray &r, const Hitable &world, int depth = 0)
+// blue, cyan, green, yellow, red for t from 0 to 1
+Vec3 heat_color(float t)
 {
-    Hit hit;
-    if (world.hit(r, 0.001, std::numeric_limits<float>::max(), hit)) {
-        Ray scattered;
-        Vec3 attenuation;
-        Vec3 emitted = hit.material->emitted(hit.u, hit.v, hit.p);
-        if (depth < 10 && hit.material->scatter(r, hit, attenuation, scattered)) {
-            return emitted + attenuation * trace_ray(scattered, world, depth + 1);
-        } else {
-            return emitted;
-        }
-    } else {
-        return Vec3(0.0, 0.0, 0.0);
+    const Vec3 ramp[] = { Vec3(0.0, 0.0, 0.5), Vec3(0.0, 0.8, 1.0), Vec3(0.1, 0.9, 0.1),
+                          Vec3(1.0, 0.9, 0.0), Vec3(0.9, 0.0, 0.0) };
+    const int last = sizeof(ramp) / sizeof(ramp[0]) - 1;
+    t = std::min(std::max(t, 0.0f), 1.0f) * last;
+    int k = std::min(int(t), last - 1);
+    float f = t - k;
+    return (1.0f - f) * ramp[k] + f * ramp[k + 1];
+}
+
+// False colors of `values` in `img_data`, scaled to the 99th percentile so
+// that a few outliers do not wash out the image; returns that scale.
+float draw_heatmap(uint8_t *img_data, int width, int height, const float *values)
+{
+    std::vector<float> sorted(values, values + width * height);
+    size_t rank = sorted.size() * 99 / 100;
+    std::nth_element(sorted.begin(), sorted.begin() + rank, sorted.end());
+    float scale = sorted[rank] > 0.0 ? sorted[rank] : 1.0;
+
+    for (int k = 0; k < width * height; ++k) {
+        Vec3 color = heat_color(values[k] / scale);
+        img_data[3*k] = color.r8();
+        img_data[3*k+1] = color.g8();
+        img_data[3*k+2] = color.b8();
     }
+    return scale;
 }
 
-void build_book_scene_bvh(HitableList &world, Camera &cam)
+// Greyscale PFM, rows stored bottom to top. stbi_write_hdr is not used, the
+// bundled version indexes past the rows.
+bool write_pfm(const char *path, int width, int height, const float *values)
 {
+    std::ofstream out(path, std::ios::binary);
+    out << "Pf\n" << width << " " << height << "\n-1.0\n";
+    for (int j = height - 1; j >= 0; --j) {
+        out.write(reinterpret_cast<const char *>(values + j * width), width * sizeof(float));
+    }
+    if (!out) {
+        std::cerr << "Error: can't write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void build_book_scene_bvh(Scene &world, Camera &cam)
+{
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(20.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
     cam.set_lens(0.2, 30.0);
 
-    world.add(new Sphere(Vec3(0, -1000, 0), 1000, new Lambertian(new CheckerTexture(Vec3(0.5, 0.5, 0.6), Vec3(1.0, 1.0, 1.0)))));
+    world.add(arena.make<Plane>(checker_ground, Vec3(0, 1, 0), pool.material(pool.lambertian(pool.checker(pool.constant(Vec3(0.5, 0.5, 0.6)), pool.constant(Vec3(1.0, 1.0, 1.0)))))));
 
-    world.add(new Sphere(Vec3(0.0, 0.0, 0.0), 10000,
-              new DiffuseLight(new ConstantTexture(Vec3(0.9, 0.9, 1.0)))));
+    world.set_environment(arena.make<ConstantEnvironment>(Vec3(0.9, 0.9, 1.0)));
 
-    std::vector<Hitable *>elems;
-        
     int n_spheres = 150;
     for (int k = 0; k < n_spheres; ++k) {
         float choose_mat = random_in_0_1();
@@ -112,34 +163,37 @@ void build_book_scene_bvh(HitableList &world, Camera &cam)
             Vec3 color(random_in_0_1() * random_in_0_1(),
                        random_in_0_1() * random_in_0_1(),
                        random_in_0_1() * random_in_0_1());
-            mat = new Lambertian(new ConstantTexture(color));
+            mat = pool.material(pool.lambertian(pool.constant(color)));
         } else if (choose_mat > 0.15) {
             Vec3 color(random_in_0_1(), random_in_0_1(), random_in_0_1());
-            mat = new Metal(new ConstantTexture(color), random_in_0_1());
+            mat = pool.material(pool.metal(pool.constant(color), random_in_0_1()));
         } else {
-            mat = new Dielectric(1.5);
+            mat = pool.material(pool.dielectric(1.5));
         }
     
         Vec3 center(30*random_in_0_1() - 15.0, 0.5, 30*random_in_0_1() - 15.0);
-        elems.push_back(new Sphere(center, 0.5, mat));
+        world.add(arena.make<Sphere>(center, 0.5, mat));
     }
-    elems.push_back(new Sphere(Vec3(0, 2, 10), 2, new Metal(new ConstantTexture(Vec3(0.8, 0.8, 0.9)), 0.0)));
-    elems.push_back(new Sphere(Vec3(0, 2, 0), 2, new Dielectric(1.5)));
-    elems.push_back(new Sphere(Vec3(0, 2, -10), 2, new Lambertian(new ConstantTexture(Vec3(0.6, 0.3, 0.05)))));
-    
-    world.add(new BVHNode(elems));
+    world.add(arena.make<Sphere>(Vec3(0, 2, 10), 2, pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.0))));
+    world.add(arena.make<Sphere>(Vec3(0, 2, 0), 2, pool.material(pool.dielectric(1.5))));
+    world.add(arena.make<Sphere>(Vec3(0, 2, -10), 2, pool.material(pool.lambertian(pool.constant(Vec3(0.6, 0.3, 0.05))))));
 }
 
-void build_book_scene(HitableList &world, Camera &cam)
+void build_book_scene(Scene &world, Camera &cam)
 {
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(20.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0.0, 1.0, 0));
     cam.set_lens(0.2, 30.0);
 
-    world.add(new Sphere(Vec3(0, -1000, 0), 1000, new Lambertian(new CheckerTexture(Vec3(0.5, 0.5, 0.6), Vec3(1.0, 1.0, 1.0)))));
+    world.add(arena.make<Plane>(checker_ground, Vec3(0, 1, 0), pool.material(pool.lambertian(pool.checker(pool.constant(Vec3(0.5, 0.5, 0.6)), pool.constant(Vec3(1.0, 1.0, 1.0)))))));
+
+    world.set_environment(arena.make<ConstantEnvironment>(Vec3(0.9, 0.9, 1.0)));
 
-    world.add(new Sphere(Vec3(0.0, 0.0, 0.0), 10000,
-              new DiffuseLight(new ConstantTexture(Vec3(0.9, 0.9, 1.0)))));
+    // a flat list: the scene's BVH ends up with this single leaf
+    HitableList *spheres = arena.make<HitableList>();
 
     int n_spheres = 150;
     for (int k = 0; k < n_spheres; ++k) {
@@ -149,36 +203,39 @@ void build_book_scene(HitableList &world, Camera &cam)
             Vec3 color(random_in_0_1() * random_in_0_1(),
                        random_in_0_1() * random_in_0_1(),
                        random_in_0_1() * random_in_0_1());
-            mat = new Lambertian(new ConstantTexture(color));
+            mat = pool.material(pool.lambertian(pool.constant(color)));
         } else if (choose_mat > 0.15) {
             Vec3 color(random_in_0_1(), random_in_0_1(), random_in_0_1());
-            mat = new Metal(new ConstantTexture(color), random_in_0_1());
+            mat = pool.material(pool.metal(pool.constant(color), random_in_0_1()));
         } else {
-            mat = new Dielectric(1.5);
+            mat = pool.material(pool.dielectric(1.5));
         }
     
         Vec3 center(30*random_in_0_1() - 15.0, 0.5, 30*random_in_0_1() - 15.0);
-        world.add(new Sphere(center, 0.5, mat));
+        spheres->add(arena.make<Sphere>(center, 0.5, mat));
     }
-    world.add(new Sphere(Vec3(0, 2, 10), 2, new Metal(new ConstantTexture(Vec3(0.8, 0.8, 0.9)), 0.0)));
-    world.add(new Sphere(Vec3(0, 2, 0), 2, new Dielectric(1.5)));
-    world.add(new Sphere(Vec3(0, 2, -10), 2, new Lambertian(new ConstantTexture(Vec3(0.6, 0.3, 0.05)))));
+    spheres->add(arena.make<Sphere>(Vec3(0, 2, 10), 2, pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.0))));
+    spheres->add(arena.make<Sphere>(Vec3(0, 2, 0), 2, pool.material(pool.dielectric(1.5))));
+    spheres->add(arena.make<Sphere>(Vec3(0, 2, -10), 2, pool.material(pool.lambertian(pool.constant(Vec3(0.6, 0.3, 0.05))))));
+
+    world.add(spheres);
 }
 
-void build_big_bvh(HitableList &world, Camera &cam)
+void build_big_bvh(Scene &world, Camera &cam)
 {
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(20.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
     cam.set_lens(0.2, 30.0);
 
-    world.add(new Sphere(Vec3(0, -1000, 0), 1000, new Lambertian(new CheckerTexture(Vec3(0.1, 0.7, 0.3),Vec3(1.0, 1.0, 1.0)))));
+    world.add(arena.make<Plane>(checker_ground, Vec3(0, 1, 0), pool.material(pool.lambertian(pool.checker(pool.constant(Vec3(0.1, 0.7, 0.3)), pool.constant(Vec3(1.0, 1.0, 1.0)))))));
 
-    world.add(new Sphere(Vec3(0.0, 0.0, 0.0), 10000,
-              new DiffuseLight(new ConstantTexture(Vec3(0.9, 0.9, 1.0)))));
+    world.set_environment(arena.make<ConstantEnvironment>(Vec3(0.9, 0.9, 1.0)));
 
     int n_spheres = 750;
 
-    std::vector<Hitable *> spheres;
     for (int i = 0; i < n_spheres; ++i) {
         Vec3 center(random_in_0_1(), random_in_0_1(), random_in_0_1());
         float radius = 0.2;
@@ -186,152 +243,614 @@ void build_big_bvh(HitableList &world, Camera &cam)
         center[1] += 3;
 
         //Material *mat = new Lambertian(Vec3(0.95, 0.95, 0.8));
-        Material *mat = new Metal(new ConstantTexture(Vec3(0.95, 0.95, 0.8)), 0.2);
-        spheres.push_back(new Sphere(center, radius, mat));
+        Material *mat = pool.material(pool.metal(pool.constant(Vec3(0.95, 0.95, 0.8)), 0.2));
+        world.add(arena.make<Sphere>(center, radius, mat));
     }
-
-    world.add(new BVHNode(spheres));
 }
 
-void build_test_perlin(HitableList &world, Camera &cam)
+void build_test_perlin(Scene &world, Camera &cam)
 {
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(20.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
     cam.set_lens(0.2, 30.0);
 
-    world.add(new Sphere(Vec3(0, -1000, 0), 1000,
-              new Metal(new ConstantTexture(Vec3(0.8, 0.8, 0.9)), 0.05)));
+    world.add(arena.make<Plane>(Vec3(0.0), Vec3(0, 1, 0),
+              pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.05))));
+
+    world.add(arena.make<Sphere>(Vec3(0, 3, 0), 3.0,
+              pool.material(pool.lambertian(pool.noise(5.0)))));
+}
+
+// texture of the image at `path`, or of its converted .rttex file (see
+// texconv) when there is one, which is mapped instead of decoded
+bool load_image_texture(Scene &world, const std::string &path, uint32_t &texture)
+{
+    MaterialPool &pool = world.materials();
+    std::string tiled = path.substr(0, path.rfind('.')) + ".rttex";
+    if (std::ifstream(tiled.c_str())) {
+        const MipMap *mipmap = world.arena().own(load_texture_file(tiled.c_str(), world.texture_cache()));
+        if (mipmap) {
+            texture = pool.image(mipmap);
+            return true;
+        }
+    }
 
-    world.add(new Sphere(Vec3(0, 3, 0), 3.0,
-              new Lambertian(new NoiseTexture(5.0))));
+    int width, height, nc;
+    uint8_t *data = stbi_load(path.c_str(), &width, &height, &nc, 0);
+    if (!data) {
+        return false;
+    }
+    texture = pool.image(data, width, height, nc);
+    return true;
 }
 
-void build_test_texture(HitableList &world, Camera &cam)
+void build_test_texture(Scene &world, Camera &cam)
 {
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(20.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
     cam.set_lens(0.2, 30.0);
 
-    world.add(new Sphere(Vec3(0, -1000, 0), 1000,
-              new Metal(new ConstantTexture(Vec3(0.8, 0.8, 0.9)), 0.05)));
+    world.add(arena.make<Plane>(Vec3(0.0), Vec3(0, 1, 0),
+              pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.05))));
 
-    world.add(new Sphere(Vec3(0.0, 0.0, 0.0), 10000,
-              new DiffuseLight(new ConstantTexture(Vec3(0.9, 0.9, 1.0)))));
+    world.set_environment(arena.make<ConstantEnvironment>(Vec3(0.9, 0.9, 1.0)));
 
-    int width, height, nc;
-    uint8_t *tex_data = stbi_load("earthmap.jpg", &width, &height, &nc, 0);
-    
-    if (tex_data) {
-        world.add(new Sphere(Vec3(0, 3.5, 0), 3.0,
-                  new Lambertian(new ImageTexture(tex_data, width, height, nc))));
+    uint32_t earth;
+    if (load_image_texture(world, "earthmap.jpg", earth)) {
+        world.add(arena.make<Sphere>(Vec3(0, 3.5, 0), 3.0, pool.material(pool.lambertian(earth))));
     }
 }
 
-void build_test_light(HitableList &world, Camera &cam)
+void build_test_light(Scene &world, Camera &cam)
 {
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
     cam.setup(35.0, 1.33333);
     cam.look_at(Vec3(-5, 2, 40), Vec3(0, 0, 0), Vec3(0, 1, 0));
     cam.set_lens(0.2, 40.0);
 
-    std::vector<Hitable *> elems;
-    elems.push_back(new Sphere(Vec3(0, -1000, 0), 1000,
-                         new Metal(new ConstantTexture(Vec3(0.8, 0.8, 0.9)), 0.1)));
+    world.add(arena.make<Plane>(Vec3(0.0), Vec3(0, 1, 0),
+              pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.1))));
  
-    //elems.push_back(new Sphere(Vec3(0.0, 0.0, 0.0), 10000,
-    //                new DiffuseLight(new ConstantTexture(Vec3(0.1, 0.1, 0.15)))));
+    //world.set_environment(new ConstantEnvironment(Vec3(0.1, 0.1, 0.15)));
 
-    int width, height, nc;
-    uint8_t *tex_data = stbi_load("../data/earthmap.jpg", &width, &height, &nc, 0);
-    
-    if (tex_data) {
-        elems.push_back(new Sphere(Vec3(0, 3.5, 0), 3.0,
-                             new Lambertian(new ImageTexture(tex_data, width, height, nc))));
+    uint32_t earth;
+    if (load_image_texture(world, "../data/earthmap.jpg", earth)) {
+        world.add(arena.make<Sphere>(Vec3(0, 3.5, 0), 3.0, pool.material(pool.lambertian(earth))));
     }
 
-    elems.push_back(new Sphere(Vec3(3.0, 1.0, 3.0), 0.5,
-                         new DiffuseLight(new ConstantTexture(Vec3(5.0, 0.5, 0.0)))));
+    world.add(arena.make<Sphere>(Vec3(3.0, 1.0, 3.0), 0.5,
+              pool.material(pool.light(pool.constant(Vec3(5.0, 0.5, 0.0))))));
 
-    Hitable *light = new XYRectangle(5, 5, new DiffuseLight(new ConstantTexture(Vec3(8.0, 8.0, 8.0))));
-    ObjectFrame *light_frame = new ObjectFrame(light);
+    Hitable *light = arena.make<XYRectangle>(5, 5, pool.material(pool.light(pool.constant(Vec3(8.0, 8.0, 8.0)))));
+    ObjectFrame *light_frame = arena.make<ObjectFrame>(light);
     light_frame->set_transform(35.0, 0.0, 0.0, 0.0, 7.0, -7.0);
-    elems.push_back(light_frame);
-    
-    world.add(new BVHNode(elems)); 
+    world.add(light_frame);
+}
+
+void build_test_environment(Scene &world, Camera &cam)
+{
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
+    cam.setup(20.0, 1.33333);
+    cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
+    cam.set_lens(0.2, 30.0);
+
+    world.add(arena.make<Plane>(Vec3(0.0), Vec3(0, 1, 0), pool.material(pool.lambertian(pool.constant(Vec3(0.5, 0.5, 0.5))))));
+
+    world.add(arena.make<Sphere>(Vec3(0, 2, 4), 2, pool.material(pool.metal(pool.constant(Vec3(0.8, 0.8, 0.9)), 0.0))));
+    world.add(arena.make<Sphere>(Vec3(0, 2, 0), 2, pool.material(pool.dielectric(1.5))));
+    world.add(arena.make<Sphere>(Vec3(0, 2, -4), 2, pool.material(pool.lambertian(pool.constant(Vec3(0.6, 0.3, 0.05))))));
+
+    // any lat-long map, .hdr files keep their dynamic range
+    int width, height, nc;
+    float *env_data = stbi_loadf("../data/sky.hdr", &width, &height, &nc, 0);
+    if (env_data) {
+        world.set_environment(arena.make<LatLongEnvironment>(env_data, width, height, nc));
+        stbi_image_free(env_data);
+    } else {
+        world.set_environment(arena.make<GradientEnvironment>(Vec3(0.5, 0.7, 1.0), Vec3(1.0, 1.0, 1.0)));
+    }
+}
+
+void build_test_mesh(Scene &world, Camera &cam)
+{
+    Arena &arena = world.arena();
+    MaterialPool &pool = world.materials();
+
+    cam.setup(20.0, 1.33333);
+    cam.look_at(Vec3(-5, 2, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
+    cam.set_lens(0.2, 30.0);
+
+    world.add(arena.make<Plane>(checker_ground, Vec3(0, 1, 0), pool.material(pool.lambertian(pool.checker(pool.constant(Vec3(0.5, 0.5, 0.6)), pool.constant(Vec3(1.0, 1.0, 1.0)))))));
+
+    world.set_environment(arena.make<GradientEnvironment>(Vec3(0.5, 0.7, 1.0), Vec3(1.0, 1.0, 1.0)));
+
+    // the converted file (see obj2mesh) is mapped instead of parsed
+    Material *mat = pool.material(pool.lambertian(pool.constant(Vec3(0.8, 0.6, 0.4))));
+    TriangleMesh *mesh = arena.own(load_mesh_file("../data/model.rtmesh", mat, BVHSettings(), bvh_cache_dir));
+    MeshBuffers buffers;
+    if (!mesh && load_obj("../data/model.obj", buffers)) {
+        mesh = arena.make<TriangleMesh>(std::move(buffers), mat, BVHSettings(), bvh_cache_dir);
+    }
+
+    if (mesh) {
+        std::cout << "Loaded " << mesh->triangle_count() << " triangles, "
+                  << mesh->memory_size() / mesh->triangle_count() << " bytes per triangle" << std::endl;
+        world.add(mesh);
+    }
+}
+
+typedef void (*SceneBuilder)(Scene &world, Camera &cam);
+
+struct BuiltinScene
+{
+    const char *name;
+    SceneBuilder build;
+};
+
+const BuiltinScene builtin_scenes[] = {
+    { "book", build_book_scene },
+    { "book_bvh", build_book_scene_bvh },
+    { "big_bvh", build_big_bvh },
+    { "perlin", build_test_perlin },
+    { "texture", build_test_texture },
+    { "light", build_test_light },
+    { "environment", build_test_environment },
+    { "mesh", build_test_mesh },
+};
+
+void usage(const char *program)
+{
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "  --scene FILE          load a scene description (see scene_file.h)\n"
+              << "  --builtin NAME        render a compiled-in scene (default: light)\n"
+              << "  --benchmark FILE      time the builtin scenes (or the --builtin one) and write a JSON report\n"
+              << "  --width N             image width (default: 960, 400 for benchmarks)\n"
+              << "  --height N            image height (default: 720, 300 for benchmarks)\n"
+              << "  --spp N               samples per pixel (default: 20, 16 for benchmarks)\n"
+              << "  --seed N              random seed (default: 1)\n"
+              << "  --aov nodes|tests|depth|time\n"
+              << "                        also write the BVH nodes visited, primitive tests, bounces or microseconds\n"
+              << "                        per pixel as a heatmap PNG and a float PFM (nodes and tests need -Dstats=true)\n"
+              << "  --trace FILE          write a timeline of the render phases (Chrome trace JSON)\n"
+              << "  --stats FILE          write the render counters as JSON (needs meson -Dstats=true)\n"
+              << "  --frames START:STOP   frame range of the animation (default: 0:100)\n"
+              << "  --threads N           number of render threads\n"
+              << "  --texture-cache MB    page the tiles of .rttex textures through a cache of this size (default: map the files)\n"
+              << "  --output PREFIX       output file prefix (default: ../out/lighting_)\n"
+              << "  --bvh binary|quantized\n"
+              << "  --bvh-cache DIR       BVH cache directory (default: bvh_cache)\n"
+              << "  --no-bvh-cache        always rebuild the BVHs\n"
+              << "  --no-packets          trace the camera and shadow rays one by one\n"
+              << "  --no-differentials    filter the textures with ray cones only\n"
+              << "  --wavefront           shade the paths in batches sorted by material\n"
+              << "  --sort-rays           group the secondary rays by direction and origin (implies --wavefront)\n"
+              << "  --orbit, --no-orbit   orbit the camera around the scene (default: on for builtin scenes)\n"
+              << "Builtin scenes:";
+    for (const BuiltinScene &scene : builtin_scenes) {
+        std::cerr << " " << scene.name;
+    }
+    std::cerr << std::endl;
+}
+
+bool parse_int(const char *s, int &value)
+{
+    char *end;
+    long v = strtol(s, &end, 10);
+    if (*s == '\0' || *end != '\0' || v < 0 || v > std::numeric_limits<int>::max()) {
+        return false;
+    }
+    value = int(v);
+    return true;
+}
+
+struct AOVName
+{
+    const char *name;
+    DebugAOV aov;
+};
+
+const AOVName aov_names[] = {
+    { "nodes", AOV_NODES_VISITED },
+    { "tests", AOV_PRIMITIVE_TESTS },
+    { "depth", AOV_PATH_DEPTH },
+    { "time", AOV_PIXEL_TIME },
+};
+
+const BuiltinScene *find_builtin(const char *name)
+{
+    for (const BuiltinScene &scene : builtin_scenes) {
+        if (strcmp(scene.name, name) == 0) {
+            return &scene;
+        }
+    }
+    return nullptr;
+}
+
+// the mesh scene is left out, it needs files from ../data
+const char *benchmark_scenes[] = { "book", "book_bvh", "big_bvh", "perlin", "texture", "light", "environment" };
+
+struct BenchmarkResult
+{
+    const char *scene;
+    double build_time;
+    double render_time;
+    uint64_t rays;
+    RenderStats stats;
+};
+
+double seconds_since(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Renders one frame of each benchmark scene from its own camera, or of
+// `only` when given. The BVH cache is not used so that the build is timed
+// too. Timings go to the console and to `report` as JSON.
+bool run_benchmark(const char *report, const char *only, int width, int height, int ns)
+{
+    if (only && std::find_if(std::begin(benchmark_scenes), std::end(benchmark_scenes),
+                             [only](const char *name) { return strcmp(name, only) == 0; }) == std::end(benchmark_scenes)) {
+        std::cerr << "Error: " << only << " is not a benchmark scene" << std::endl;
+        return false;
+    }
+
+    int threads = omp_get_max_threads();
+    std::vector<Vec3> image(width * height);
+    std::vector<BenchmarkResult> results;
+
+    std::cout << width << "x" << height << ", " << ns << " spp, " << threads << " threads\n"
+              << std::left << std::setw(14) << "scene" << std::right << std::setw(10) << "build ms"
+              << std::setw(10) << "render s" << std::setw(10) << "Mrays"
+              << std::setw(10) << "Mrays/s" << std::setw(14) << "Mrays/s/thr" << std::endl;
+
+    for (const char *name : benchmark_scenes) {
+        if (only && strcmp(name, only) != 0) {
+            continue;
+        }
+        TRACE_SCOPE(name);
+
+        // the builders place objects at random, the same ones every time
+        seed_random(render_settings.seed, 0);
+        Scene world;
+        Camera cam;
+        find_builtin(name)->build(world, cam);
+
+        BenchmarkResult result;
+        result.scene = name;
+        auto start = std::chrono::steady_clock::now();
+        world.build(BVHSettings(), nullptr, quantized_bvh);
+        result.build_time = seconds_since(start);
+
+#ifdef RT_STATS
+        reset_stats();
+#endif
+        start = std::chrono::steady_clock::now();
+        result.rays = render(world, cam, width, height, ns, render_settings, image.data());
+        result.render_time = seconds_since(start);
+#ifdef RT_STATS
+        result.stats = collect_stats();
+#endif
+        results.push_back(result);
+
+        double mrays_per_s = result.rays / result.render_time * 1e-6;
+        std::cout << std::left << std::setw(14) << name << std::right << std::fixed
+                  << std::setprecision(2) << std::setw(10) << result.build_time * 1e3
+                  << std::setprecision(3) << std::setw(10) << result.render_time
+                  << std::setprecision(2) << std::setw(10) << result.rays * 1e-6
+                  << std::setw(10) << mrays_per_s
+                  << std::setw(14) << mrays_per_s / threads << std::endl;
+    }
+
+    std::ofstream out(report);
+    out << "{\n"
+        << "  \"width\": " << width << ",\n"
+        << "  \"height\": " << height << ",\n"
+        << "  \"spp\": " << ns << ",\n"
+        << "  \"threads\": " << threads << ",\n"
+        << "  \"seed\": " << render_settings.seed << ",\n"
+        << "  \"bvh\": \"" << (quantized_bvh ? "quantized" : "binary") << "\",\n"
+        << "  \"wavefront\": " << (render_settings.wavefront ? "true" : "false") << ",\n"
+        << "  \"sort_rays\": " << (render_settings.sort_rays ? "true" : "false") << ",\n"
+        << "  \"packets\": " << (render_settings.packets ? "true" : "false") << ",\n"
+        << "  \"differentials\": " << (render_settings.differentials ? "true" : "false") << ",\n"
+        << "  \"scenes\": [\n";
+    out << std::setprecision(6);
+    for (size_t k = 0; k < results.size(); ++k) {
+        const BenchmarkResult &r = results[k];
+        double rays_per_s = r.rays / r.render_time;
+        out << "    { \"name\": \"" << r.scene << "\""
+            << ", \"build_seconds\": " << r.build_time
+            << ", \"render_seconds\": " << r.render_time
+            << ", \"rays\": " << r.rays
+            << ", \"rays_per_second\": " << rays_per_s
+            << ", \"rays_per_second_per_thread\": " << rays_per_s / threads;
+#ifdef RT_STATS
+        out << ", \"stats\": ";
+        r.stats.write_json(out, 4);
+#endif
+        out << " }" << (k + 1 < results.size() ? "," : "") << "\n";
+    }
+    out << "  ]\n}\n";
+
+    if (!out) {
+        std::cerr << "Error: can't write " << report << std::endl;
+        return false;
+    }
+    std::cout << "Saving " << report << std::endl;
+    return true;
 }
 
 int main(int argc, char *argv[])
 {
-    HitableList world;
+    const char *scene_file = nullptr;
+    const char *builtin = nullptr;
+    const char *benchmark = nullptr;
+    const char *stats_file = nullptr;
+    const char *aov_name = nullptr;
+    const char *trace_file = nullptr;
+    // 0 until given, the defaults depend on the mode
+    int width = 0;
+    int height = 0;
+    int ns = 0;
+    int start = 0;
+    int stop = 100;
+    int threads = 0;
+    int texture_cache_mb = 0;
+    const char *filename = "../out/lighting_";
+    int orbit = -1;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool has_value = i + 1 < argc;
+        bool ok = true;
+        if (arg == "--help" || arg == "-h") {
+            usage(argv[0]);
+            return 0;
+        } else if (arg == "--no-bvh-cache") {
+            bvh_cache_dir = nullptr;
+        } else if (arg == "--no-packets") {
+            render_settings.packets = false;
+        } else if (arg == "--no-differentials") {
+            render_settings.differentials = false;
+        } else if (arg == "--wavefront") {
+            render_settings.wavefront = true;
+        } else if (arg == "--sort-rays") {
+            render_settings.wavefront = true;
+            render_settings.sort_rays = true;
+        } else if (arg == "--orbit") {
+            orbit = 1;
+        } else if (arg == "--no-orbit") {
+            orbit = 0;
+        } else if (!has_value) {
+            ok = false;
+        } else if (arg == "--scene") {
+            scene_file = argv[++i];
+        } else if (arg == "--builtin") {
+            builtin = argv[++i];
+        } else if (arg == "--benchmark") {
+            benchmark = argv[++i];
+        } else if (arg == "--aov") {
+            std::string name = argv[++i];
+            ok = false;
+            for (const AOVName &a : aov_names) {
+                if (name == a.name) {
+                    render_settings.aov = a.aov;
+                    aov_name = a.name;
+                    ok = true;
+                }
+            }
+        } else if (arg == "--trace") {
+            trace_file = argv[++i];
+        } else if (arg == "--stats") {
+            stats_file = argv[++i];
+        } else if (arg == "--seed") {
+            int seed;
+            ok = parse_int(argv[++i], seed);
+            render_settings.seed = seed;
+        } else if (arg == "--width") {
+            ok = parse_int(argv[++i], width) && width > 0;
+        } else if (arg == "--height") {
+            ok = parse_int(argv[++i], height) && height > 0;
+        } else if (arg == "--spp") {
+            ok = parse_int(argv[++i], ns) && ns > 0;
+        } else if (arg == "--threads") {
+            ok = parse_int(argv[++i], threads) && threads > 0;
+        } else if (arg == "--texture-cache") {
+            ok = parse_int(argv[++i], texture_cache_mb) && texture_cache_mb > 0;
+        } else if (arg == "--frames") {
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+            ok = colon != std::string::npos
+                && parse_int(range.substr(0, colon).c_str(), start)
+                && parse_int(range.substr(colon + 1).c_str(), stop)
+                && start < stop;
+        } else if (arg == "--output") {
+            filename = argv[++i];
+        } else if (arg == "--bvh") {
+            std::string type = argv[++i];
+            ok = type == "binary" || type == "quantized";
+            quantized_bvh = type == "quantized";
+        } else if (arg == "--bvh-cache") {
+            bvh_cache_dir = argv[++i];
+        } else {
+            ok = false;
+        }
+
+        if (!ok) {
+            std::cerr << "Error: bad argument " << arg << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+    }
+
+#ifndef RT_STATS
+    if (stats_file) {
+        std::cerr << "Error: --stats needs a build with the stats option (meson -Dstats=true)" << std::endl;
+        return 1;
+    }
+    if (render_settings.aov == AOV_NODES_VISITED || render_settings.aov == AOV_PRIMITIVE_TESTS) {
+        std::cerr << "Error: --aov " << aov_name << " needs a build with the stats option (meson -Dstats=true)" << std::endl;
+        return 1;
+    }
+#endif
+
+    if (threads > 0) {
+        omp_set_num_threads(threads);
+    }
+
+    if (trace_file) {
+        start_trace();
+    }
+
+    if (benchmark) {
+        bool ok = run_benchmark(benchmark, builtin, width ? width : 400, height ? height : 300, ns ? ns : 16);
+        if (trace_file) {
+            ok = write_trace(trace_file) && ok;
+        }
+        return ok ? 0 : 1;
+    }
+
+    width = width ? width : 960;
+    height = height ? height : 720;
+    ns = ns ? ns : 20;
+
+    Scene world;
     Camera cam;
+    if (texture_cache_mb > 0) {
+        world.set_texture_cache(size_t(texture_cache_mb) << 20);
+    }
 
-    //build_book_scene_bvh(world, cam);
-    //build_book_scene(world, cam);
-    
-    //build_big_bvh(world, cam);
-    
-    //build_test_perlin(world, cam);
-    //build_test_texture(world, cam);
+    if (scene_file) {
+        TRACE_SCOPE("scene load");
+        if (!load_scene_file(scene_file, world, cam, bvh_cache_dir)) {
+            return 1;
+        }
+    } else {
+        const BuiltinScene *scene = find_builtin(builtin ? builtin : "light");
+        if (!scene) {
+            std::cerr << "Error: unknown builtin scene " << builtin << std::endl;
+            usage(argv[0]);
+            return 1;
+        }
+        TRACE_SCOPE("scene build");
+        scene->build(world, cam);
+    }
 
-    build_test_light(world, cam);
+    // the orbit animation only makes sense for the builtin scenes, scene
+    // files render from their own camera
+    if (orbit < 0) {
+        orbit = scene_file ? 0 : 1;
+    }
+
+    world.build(BVHSettings(), bvh_cache_dir, quantized_bvh);
+    std::cout << world.materials().material_count() << " materials, "
+              << world.materials().texture_count() << " textures" << std::endl;
 
-    int width = 960;
-    int height = 720;
-    
     uint8_t * pixels = new uint8_t[3*width*height];
+    Vec3 *radiance = new Vec3[width*height];
+    float *aov = aov_name ? new float[width*height] : nullptr;
+    RenderStats total_stats;
     
-    int ns = 20;
-    
-    int start = 0;
-    int stop = 100;
     int tmax = 100;
-    const char * filename = "../out/lighting_";
     for (int t = start; t < stop; t++) {
-        float tm = tmax > 1 ? float(t) / (tmax-1) : 0.5;
-        tm = (sin(-M_PI/2 + tm*M_PI) + 1.0) / 2.0;
-
-        /*cam.set_lens(0.5, 30.0 - (20 * tm - 10));    
-        float x = -9 + tm * 6;
-        float y = 8 - tm;
-        cam.look_at(Vec3(x, y, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
-        */
-        float x = 50.0 * sin(2*tm*M_PI);
-        float y = 8 + 10 * 4*(tm-0.5)*(tm-0.5);
-        float z = 50.0 * cos(2*tm*M_PI);
-        //cam.look_at(Vec3(x, y, z), Vec3(0, 3, 0), Vec3(0, 1, 0));
-        cam.look_at(Vec3(x, y, z), Vec3(0, 1, 0), Vec3(0.5, 0.5, 0));
+        TRACE_SCOPE("frame");
+        if (orbit) {
+            float tm = tmax > 1 ? float(t) / (tmax-1) : 0.5;
+            tm = (sin(-M_PI/2 + tm*M_PI) + 1.0) / 2.0;
+
+            /*cam.set_lens(0.5, 30.0 - (20 * tm - 10));    
+            float x = -9 + tm * 6;
+            float y = 8 - tm;
+            cam.look_at(Vec3(x, y, 30), Vec3(0, 0, 0), Vec3(0, 1, 0));
+            */
+            float x = 50.0 * sin(2*tm*M_PI);
+            float y = 8 + 10 * 4*(tm-0.5)*(tm-0.5);
+            float z = 50.0 * cos(2*tm*M_PI);
+            //cam.look_at(Vec3(x, y, z), Vec3(0, 3, 0), Vec3(0, 1, 0));
+            cam.look_at(Vec3(x, y, z), Vec3(0, 1, 0), Vec3(0.5, 0.5, 0));
+        }
         
         std::cout << "Rendering frame " << t << std::endl;
 
-        #pragma omp parallel for
-        for (int j = 0; j < height; ++j) {
-            for (int i = 0; i < width; ++i) {
-                Vec3 color(0.0);
-                for (int s = 0; s < ns; ++s) {
-                    float u = float(i + random_in_0_1()) / width;
-                    float v = float(height - j + random_in_0_1()) / height;
-            
-                    Ray r = cam.get_ray(u, v);       
-
-                    color += trace_ray(r, world);
-                }
-                color /= float(ns);
-                pixels[3*(width*j + i)] = color.r8();
-                pixels[3*(width*j + i)+1] = color.g8();
-                pixels[3*(width*j + i)+2] = color.b8();
-            }
+#ifdef RT_STATS
+        reset_stats();
+#endif
+        {
+            TRACE_SCOPE("render");
+            render(world, cam, width, height, ns, render_settings, radiance, aov);
+        }
+#ifdef RT_STATS
+        RenderStats frame_stats = collect_stats();
+        frame_stats.print(std::cout);
+        total_stats.add(frame_stats);
+#endif
+        if (world.texture_cache()) {
+            world.texture_cache()->print_stats(std::cout);
+        }
+        for (int k = 0; k < width*height; ++k) {
+            Vec3 color = radiance[k] / float(ns);
+            pixels[3*k] = color.r8();
+            pixels[3*k+1] = color.g8();
+            pixels[3*k+2] = color.b8();
         }
 
-        draw_world_axis(pixels, width, height, cam, 3.0);
+        {
+            TRACE_SCOPE("axis overlay");
+            draw_world_axis(pixels, width, height, cam, 3.0);
+        }
 
         std::stringstream ss;
         ss << filename << std::setw(3) << std::setfill('0') << t << ".png";
         std::string fname = ss.str(); 
         std::cout << "Saving " << fname << std::endl;
-        stbi_write_png(fname.c_str(), width, height, 3, pixels, 3 * width);
+        {
+            TRACE_SCOPE("write png");
+            stbi_write_png(fname.c_str(), width, height, 3, pixels, 3 * width);
+        }
+
+        if (aov) {
+            TRACE_SCOPE("write aov");
+            ss.str(std::string());
+            ss << filename << aov_name << "_" << std::setw(3) << std::setfill('0') << t;
+            std::string aov_file = ss.str();
+            float scale = draw_heatmap(pixels, width, height, aov);
+            std::cout << "Saving " << aov_file << ".png (red at " << scale << " " << aov_name << ") and .pfm" << std::endl;
+            stbi_write_png((aov_file + ".png").c_str(), width, height, 3, pixels, 3 * width);
+            write_pfm((aov_file + ".pfm").c_str(), width, height, aov);
+        }
 
         ss.str(std::string());
     }
 
     delete [] pixels;
+    delete [] radiance;
+    delete [] aov;
+
+    if (stats_file) {
+        std::ofstream out(stats_file);
+        total_stats.write_json(out);
+        out << "\n";
+        if (!out) {
+            std::cerr << "Error: can't write " << stats_file << std::endl;
+            return 1;
+        }
+        std::cout << "Saving " << stats_file << std::endl;
+    }
+    if (trace_file) {
+        if (!write_trace(trace_file)) {
+            return 1;
+        }
+        std::cout << "Saving " << trace_file << std::endl;
+    }
     return 0;
 }
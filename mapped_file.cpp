@@ -0,0 +1,42 @@
+#include "mapped_file.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+bool MappedFile::open(const char *path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return false;
+    }
+
+    void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    // the mapping stays valid after the descriptor is closed
+    ::close(fd);
+    if (p == MAP_FAILED) {
+        return false;
+    }
+
+    ptr = p;
+    length = st.st_size;
+    return true;
+}
+
+void MappedFile::close()
+{
+    if (ptr) {
+        munmap(ptr, length);
+        ptr = nullptr;
+        length = 0;
+    }
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stddef.h>
+#include <utility>
+
+// Read-only memory mapping of a whole file, unmapped on destruction
+class MappedFile
+{
+public:
+    MappedFile() : ptr(nullptr), length(0) { }
+
+    ~MappedFile() { close(); }
+
+    MappedFile(const MappedFile &) = delete;
+
+    MappedFile& operator=(const MappedFile &) = delete;
+
+    bool open(const char *path);
+
+    void close();
+
+    bool is_open() const { return ptr != nullptr; }
+
+    const void *data() const { return ptr; }
+
+    size_t size() const { return length; }
+
+    void swap(MappedFile &other)
+    {
+        std::swap(ptr, other.ptr);
+        std::swap(length, other.length);
+    }
+
+private:
+    void *ptr;
+    size_t length;
+};
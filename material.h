@@ -1,66 +1,119 @@
 #pragma once
 
 #include "hitable.h"
+#include "ray.h"
 #include "utils.h"
 #include "texture.h"
 
+// Closed set of material kinds in one compact record: shading switches on
+// the kind instead of going through a virtual call, and callers can group
+// hits by kind(). The subclasses below only construct the record.
 class Material
 {
 public:
-    virtual ~Material() = default;
-    
-    virtual bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const = 0;
+    enum Kind : uint8_t
+    {
+        LAMBERTIAN,
+        METAL,
+        DIELECTRIC,
+        DIFFUSE_LIGHT
+    };
+
+    Kind kind() const { return type; }
+
+    // whether shading reads the hit's (u, v), primitives skip computing
+    // them otherwise
+    bool needs_uv() const { return inputs & Texture::NEEDS_UV; }
+
+    bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
+    {
+        switch (type) {
+        case LAMBERTIAN:
+            return scatter_lambertian(hit, attenuation, scattered);
+        case METAL:
+            return scatter_metal(incoming, hit, attenuation, scattered);
+        case DIELECTRIC:
+            return scatter_dielectric(incoming, hit, attenuation, scattered);
+        case DIFFUSE_LIGHT:
+            return false;
+        }
+        return false;
+    }
 
-    virtual Vec3 emitted(float u, float v, const Vec3 &p) const
+    Vec3 emitted(const Hit &hit) const
     {
+        if (type == DIFFUSE_LIGHT) {
+            return texture_value(hit);
+        }
         return Vec3(0.0, 0.0, 0.0);
     }
-};
 
-class Lambertian : public Material
-{
-public:
-    Lambertian(Texture *a) : albedo(a) { }
+    // glossiness of metals, 0 for the other kinds
+    float roughness() const { return type == METAL ? param : 0.0f; }
+
+    // of dielectrics
+    float ior() const { return param; }
 
-    virtual bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
+    // true for ideal diffuse materials, whose scattered rays have density
+    // cos(theta) / pi and which can thus receive direct lighting
+    bool diffuse(const Hit &hit, Vec3 &albedo) const
     {
-        Vec3 target = hit.p + hit.normal + random_in_unit_sphere();
-        scattered = Ray(hit.p, target - hit.p);
-        attenuation = albedo->value(hit.u, hit.v, hit.p);
-        return true;   
+        if (type == LAMBERTIAN) {
+            albedo = texture_value(hit);
+            return true;
+        }
+        return false;
+    }
+
+protected:
+    Material(Kind _type, const Texture *_texture, float _param)
+    : texture(_texture), param(_param), type(_type), inputs(_texture ? _texture->needs() : 0)
+    {
+        // constant textures are folded in the material
+        if (_texture && _texture->is_constant()) {
+            constant = _texture->value(0.0, 0.0, Vec3(0.0));
+        }
     }
 
+    // albedo, or emission of lights
+    const Texture *texture;
+    // value of texture when it doesn't vary
+    Vec3 constant;
+    // glossiness of metals, index of refraction of dielectrics
+    float param;
+    Kind type;
+    uint8_t inputs;
+
 private:
-    Texture *albedo;
-};
+    Vec3 texture_value(const Hit &hit) const
+    {
+        return inputs == Texture::NEEDS_NOTHING ? constant
+                                                : texture->value(hit.u, hit.v, hit.p, hit.uv_footprint(), hit.footprint);
+    }
 
-class Metal : public Material
-{
-public:
-    Metal(Texture *a, float g = 0.0) : albedo(a), glossiness(g) { }
+    bool scatter_lambertian(const Hit &hit, Vec3 &attenuation, Ray &scattered) const
+    {
+        Vec3 direction = hit.normal + random_unit_vector();
+        // the sample can cancel the normal out
+        if (direction.squared_length() < 1e-8) {
+            direction = hit.normal;
+        }
+        scattered = Ray(hit.p, direction);
+        attenuation = texture_value(hit);
+        return true;   
+    }
 
-    virtual bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
+    bool scatter_metal(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
     {
         Vec3 reflected = reflect(unit_vector(incoming.direction()), hit.normal);
-        scattered = Ray(hit.p, reflected + glossiness * random_in_unit_sphere());
-        attenuation = albedo->value(hit.u, hit.v, hit.p);
+        scattered = Ray(hit.p, reflected + param * random_in_unit_sphere());
+        attenuation = texture_value(hit);
         return (dot(scattered.direction(), hit.normal) > 0.0);
     }
 
-private:
-     
-    Texture *albedo;
-    float glossiness;
-};
-
-
-class Dielectric : public Material
-{
-public:
-    Dielectric(float _ior) : ior(_ior) { };
-
-    virtual bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
+    bool scatter_dielectric(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const
     {
+        float ior = param;
         Vec3 reflected = reflect(incoming.direction(), hit.normal);
 
         attenuation = Vec3(1.0, 1.0, 1.0);
@@ -98,33 +151,37 @@ public:
         return true;
     }
 
-private:
     static float schlick(float cosine, float ior)
     {
         float r0 = (1 - ior) / (1 + ior);
         r0 *= r0;
         return r0 + (1 - r0) * pow(1 - cosine, 5);
     }
-
-    float ior;
 };
 
-
-class DiffuseLight : public Material
+class Lambertian : public Material
 {
 public:
-    DiffuseLight(Texture *e) : emit(e) { }
+    Lambertian(const Texture *a) : Material(LAMBERTIAN, a, 0.0) { }
+};
 
-    virtual bool scatter(const Ray &incoming, const Hit &hit, Vec3 &attenuation, Ray &scattered) const override
-    {
-        return false;
-    }
+class Metal : public Material
+{
+public:
+    Metal(const Texture *a, float g = 0.0) : Material(METAL, a, g) { }
+};
 
-    virtual Vec3 emitted(float u, float v, const Vec3 &p) const override
-    {
-        return emit->value(u, v, p);
-    }
+class Dielectric : public Material
+{
+public:
+    Dielectric(float _ior) : Material(DIELECTRIC, nullptr, _ior) { }
+};
 
-private:
-    Texture *emit;
+class DiffuseLight : public Material
+{
+public:
+    DiffuseLight(const Texture *e) : Material(DIFFUSE_LIGHT, e, 0.0) { }
 };
+
+static_assert(sizeof(Lambertian) == sizeof(Material) && sizeof(DiffuseLight) == sizeof(Material),
+              "material kinds must not add members");
@@ -0,0 +1,140 @@
+#include "material_pool.h"
+#include "material.h"
+#include "texture.h"
+
+#include <string.h>
+
+namespace {
+
+uint32_t float_bits(float f)
+{
+    uint32_t bits;
+    memcpy(&bits, &f, sizeof(bits));
+    return bits;
+}
+
+} // namespace
+
+MaterialPool::Key::Key(Kind kind)
+{
+    memset(words, 0, sizeof(words));
+    words[0] = kind;
+}
+
+bool MaterialPool::Key::operator<(const Key &other) const
+{
+    return memcmp(words, other.words, sizeof(words)) < 0;
+}
+
+template<typename T, typename... Args>
+uint32_t MaterialPool::intern_texture(const Key &key, Args&&... args)
+{
+    auto it = texture_ids.find(key);
+    if (it != texture_ids.end()) {
+        return it->second;
+    }
+    uint32_t id = textures.size();
+    textures.push_back(arena.make<T>(std::forward<Args>(args)...));
+    texture_ids[key] = id;
+    return id;
+}
+
+template<typename T, typename... Args>
+uint32_t MaterialPool::intern_material(const Key &key, Args&&... args)
+{
+    auto it = material_ids.find(key);
+    if (it != material_ids.end()) {
+        return it->second;
+    }
+    uint32_t id = materials.size();
+    materials.push_back(arena.make<T>(std::forward<Args>(args)...));
+    material_ids[key] = id;
+    return id;
+}
+
+uint32_t MaterialPool::constant(const Vec3 &color)
+{
+    Key key(CONSTANT);
+    key.words[1] = float_bits(color[0]);
+    key.words[2] = float_bits(color[1]);
+    key.words[3] = float_bits(color[2]);
+    return intern_texture<ConstantTexture>(key, color);
+}
+
+uint32_t MaterialPool::checker(uint32_t texture1, uint32_t texture2, float scale)
+{
+    Key key(CHECKER);
+    key.words[1] = texture1;
+    key.words[2] = texture2;
+    key.words[3] = float_bits(scale);
+    return intern_texture<CheckerTexture>(key, textures[texture1], textures[texture2], scale);
+}
+
+uint32_t MaterialPool::noise(float scale)
+{
+    Key key(NOISE);
+    key.words[1] = float_bits(scale);
+    return intern_texture<NoiseTexture>(key, scale);
+}
+
+uint32_t MaterialPool::image(const uint8_t *data, int width, int height, int nc)
+{
+    Key key(IMAGE);
+    uint64_t address = reinterpret_cast<uintptr_t>(data);
+    key.words[1] = uint32_t(address);
+    key.words[2] = uint32_t(address >> 32);
+    key.words[3] = width;
+    key.words[4] = height;
+    key.words[5] = nc;
+    auto found = texture_ids.find(key);
+    if (found != texture_ids.end()) {
+        return found->second;
+    }
+    return intern_texture<ImageTexture>(key, arena.make<MipMap>(data, width, height, nc));
+}
+
+uint32_t MaterialPool::image(const MipMap *mipmap)
+{
+    Key key(MIPMAP);
+    uint64_t address = reinterpret_cast<uintptr_t>(mipmap);
+    key.words[1] = uint32_t(address);
+    key.words[2] = uint32_t(address >> 32);
+    return intern_texture<ImageTexture>(key, mipmap);
+}
+
+uint32_t MaterialPool::lambertian(uint32_t albedo)
+{
+    Key key(LAMBERTIAN);
+    key.words[1] = albedo;
+    return intern_material<Lambertian>(key, textures[albedo]);
+}
+
+uint32_t MaterialPool::metal(uint32_t albedo, float glossiness)
+{
+    Key key(METAL);
+    key.words[1] = albedo;
+    key.words[2] = float_bits(glossiness);
+    return intern_material<Metal>(key, textures[albedo], glossiness);
+}
+
+uint32_t MaterialPool::dielectric(float ior)
+{
+    Key key(DIELECTRIC);
+    key.words[1] = float_bits(ior);
+    return intern_material<Dielectric>(key, ior);
+}
+
+uint32_t MaterialPool::light(uint32_t emit)
+{
+    Key key(LIGHT);
+    key.words[1] = emit;
+    return intern_material<DiffuseLight>(key, textures[emit]);
+}
+
+void MaterialPool::clear()
+{
+    textures.clear();
+    materials.clear();
+    texture_ids.clear();
+    material_ids.clear();
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include "vec3.h"
+#include "arena.h"
+
+#include <stdint.h>
+#include <map>
+#include <vector>
+
+class Texture;
+class Material;
+class MipMap;
+
+// Interns textures and materials by their parameters, so that objects
+// created with the same settings share one instance. Every distinct entry
+// gets a dense 32-bit id; the instances live in the arena given at
+// construction.
+class MaterialPool
+{
+public:
+    MaterialPool(Arena &_arena) : arena(_arena) { }
+
+    MaterialPool(const MaterialPool &) = delete;
+
+    MaterialPool& operator=(const MaterialPool &) = delete;
+
+    // textures
+    uint32_t constant(const Vec3 &color);
+    uint32_t checker(uint32_t texture1, uint32_t texture2, float scale = 10.0);
+    uint32_t noise(float scale);
+    // builds a mip pyramid of the pixels, which are keyed by address
+    uint32_t image(const uint8_t *data, int width, int height, int nc);
+    // an existing pyramid, e.g. from a texture file, keyed by address
+    uint32_t image(const MipMap *mipmap);
+
+    // materials
+    uint32_t lambertian(uint32_t albedo);
+    uint32_t metal(uint32_t albedo, float glossiness = 0.0);
+    uint32_t dielectric(float ior);
+    uint32_t light(uint32_t emit);
+
+    Texture *texture(uint32_t id) const { return textures[id]; }
+
+    Material *material(uint32_t id) const { return materials[id]; }
+
+    size_t texture_count() const { return textures.size(); }
+
+    size_t material_count() const { return materials.size(); }
+
+    // forgets every entry, the owner resets the arena
+    void clear();
+
+private:
+    enum Kind
+    {
+        CONSTANT,
+        CHECKER,
+        NOISE,
+        IMAGE,
+        MIPMAP,
+        LAMBERTIAN,
+        METAL,
+        DIELECTRIC,
+        LIGHT
+    };
+
+    // parameters compared bit for bit
+    struct Key
+    {
+        Key(Kind kind);
+
+        bool operator<(const Key &other) const;
+
+        uint32_t words[6];
+    };
+
+    template<typename T, typename... Args>
+    uint32_t intern_texture(const Key &key, Args&&... args);
+
+    template<typename T, typename... Args>
+    uint32_t intern_material(const Key &key, Args&&... args);
+
+    Arena &arena;
+    std::vector<Texture *> textures;
+    std::vector<Material *> materials;
+    std::map<Key, uint32_t> texture_ids;
+    std::map<Key, uint32_t> material_ids;
+};
@@ -0,0 +1,185 @@
+#include "mesh.h"
+#include "material.h"
+
+bool intersect_triangle(const WatertightRay &wr, const Vec3 &v0, const Vec3 &v1, const Vec3 &v2,
+                        float tmin, float tmax, float &t, float b[3])
+{
+    Vec3 A = v0 - wr.origin;
+    Vec3 B = v1 - wr.origin;
+    Vec3 C = v2 - wr.origin;
+
+    // shear and scale the vertices so that the ray goes along +z
+    float ax = A[wr.kx] - wr.sx * A[wr.kz];
+    float ay = A[wr.ky] - wr.sy * A[wr.kz];
+    float bx = B[wr.kx] - wr.sx * B[wr.kz];
+    float by = B[wr.ky] - wr.sy * B[wr.kz];
+    float cx = C[wr.kx] - wr.sx * C[wr.kz];
+    float cy = C[wr.ky] - wr.sy * C[wr.kz];
+
+    float u = cx * by - cy * bx;
+    float v = ax * cy - ay * cx;
+    float w = bx * ay - by * ax;
+
+    // on an edge the float results can't be trusted, redo them in double
+    if (u == 0.0f || v == 0.0f || w == 0.0f) {
+        u = float(double(cx) * double(by) - double(cy) * double(bx));
+        v = float(double(ax) * double(cy) - double(ay) * double(cx));
+        w = float(double(bx) * double(ay) - double(by) * double(ax));
+    }
+
+    if ((u < 0.0f || v < 0.0f || w < 0.0f) && (u > 0.0f || v > 0.0f || w > 0.0f)) {
+        return false;
+    }
+
+    float det = u + v + w;
+    if (det == 0.0f) {
+        return false;
+    }
+
+    float az = wr.sz * A[wr.kz];
+    float bz = wr.sz * B[wr.kz];
+    float cz = wr.sz * C[wr.kz];
+    float T = u * az + v * bz + w * cz;
+
+    float inv_det = 1.0f / det;
+    t = T * inv_det;
+    if (t <= tmin || t >= tmax) {
+        return false;
+    }
+
+    b[0] = u * inv_det;
+    b[1] = v * inv_det;
+    b[2] = w * inv_det;
+    return true;
+}
+
+TriangleMesh::TriangleMesh(MeshBuffers &&buffers, Material *_material, const BVHSettings &settings, const char *cache_dir)
+: owned(std::move(buffers)), material(_material)
+{
+    positions = owned.positions.data();
+    normals = owned.normals.empty() ? nullptr : owned.normals.data();
+    uvs = owned.uvs.empty() ? nullptr : owned.uvs.data();
+    indices = owned.indices.data();
+    n_vertices = owned.positions.size();
+    n_triangles = owned.indices.size() / 3;
+
+    build_bvh(settings, cache_dir);
+}
+
+void triangle_bounds(const Vec3 *positions, const uint32_t *indices, uint32_t n_triangles, std::vector<AABB> &boxes)
+{
+    boxes.resize(n_triangles);
+    for (uint32_t i = 0; i < n_triangles; ++i) {
+        const Vec3 &a = positions[indices[3 * i]];
+        const Vec3 &b = positions[indices[3 * i + 1]];
+        const Vec3 &c = positions[indices[3 * i + 2]];
+        Vec3 bmin(fmin(a.x(), fmin(b.x(), c.x())), fmin(a.y(), fmin(b.y(), c.y())), fmin(a.z(), fmin(b.z(), c.z())));
+        Vec3 bmax(fmax(a.x(), fmax(b.x(), c.x())), fmax(a.y(), fmax(b.y(), c.y())), fmax(a.z(), fmax(b.z(), c.z())));
+        boxes[i] = AABB(bmin, bmax);
+    }
+}
+
+void TriangleMesh::build_bvh(const BVHSettings &settings, const char *cache_dir)
+{
+    std::vector<AABB> boxes;
+    triangle_bounds(positions, indices, n_triangles, boxes);
+    load_or_build(bvh, boxes, settings, cache_dir);
+}
+
+bool TriangleMesh::hit(const Ray &ray, float tmin, float tmax, Hit &hit) const
+{
+    WatertightRay wr(ray);
+    uint32_t hit_triangle = 0;
+    float hit_b[3] = { 0.0f, 0.0f, 0.0f };
+
+    bool got_hit = bvh.hit(ray, tmin, tmax, hit,
+        [&](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+            uint32_t tri = bvh.primitive(i);
+            const uint32_t *idx = indices + 3 * tri;
+            float t, b[3];
+            if (intersect_triangle(wr, positions[idx[0]], positions[idx[1]], positions[idx[2]], t0, t1, t, b)) {
+                h.t = t;
+                hit_triangle = tri;
+                hit_b[0] = b[0];
+                hit_b[1] = b[1];
+                hit_b[2] = b[2];
+                return true;
+            }
+            return false;
+        });
+
+    if (!got_hit) {
+        return false;
+    }
+
+    // shading attributes only for the closest triangle
+    const uint32_t *idx = indices + 3 * hit_triangle;
+    const Vec3 &p0 = positions[idx[0]];
+    const Vec3 &p1 = positions[idx[1]];
+    const Vec3 &p2 = positions[idx[2]];
+
+    hit.p = ray.point_at_parameter(hit.t);
+    hit.material = material;
+
+    Vec3 n;
+    if (normals) {
+        n = hit_b[0] * normals[idx[0]] + hit_b[1] * normals[idx[1]] + hit_b[2] * normals[idx[2]];
+    }
+    if (!normals || n.squared_length() < 1e-12f) {
+        n = cross(p1 - p0, p2 - p0);
+    }
+    hit.normal = unit_vector(n);
+    // the shading normals are interpolated, their variation is ignored
+    hit.curvature = 0.0f;
+
+    if (!material->needs_uv()) {
+        hit.u = hit.v = 0.0f;
+        hit.dpdu = hit.dpdv = Vec3(0.0f);
+        return true;
+    }
+
+    // without uvs, or when they are degenerate, (u, v) are the barycentric
+    // coordinates of p1 and p2
+    hit.dpdu = p1 - p0;
+    hit.dpdv = p2 - p0;
+    if (uvs) {
+        const float *uv0 = uvs + 2 * idx[0];
+        const float *uv1 = uvs + 2 * idx[1];
+        const float *uv2 = uvs + 2 * idx[2];
+        hit.u = hit_b[0] * uv0[0] + hit_b[1] * uv1[0] + hit_b[2] * uv2[0];
+        hit.v = hit_b[0] * uv0[1] + hit_b[1] * uv1[1] + hit_b[2] * uv2[1];
+
+        float du02 = uv0[0] - uv2[0], dv02 = uv0[1] - uv2[1];
+        float du12 = uv1[0] - uv2[0], dv12 = uv1[1] - uv2[1];
+        float det = du02 * dv12 - dv02 * du12;
+        if (fabsf(det) > 1e-12f) {
+            Vec3 dp02 = p0 - p2;
+            Vec3 dp12 = p1 - p2;
+            hit.dpdu = (dv12 * dp02 - dv02 * dp12) / det;
+            hit.dpdv = (du02 * dp12 - du12 * dp02) / det;
+        }
+    } else {
+        hit.u = hit_b[1];
+        hit.v = hit_b[2];
+    }
+
+    return true;
+}
+
+bool TriangleMesh::occluded(const Ray &ray, float tmin, float tmax) const
+{
+    WatertightRay wr(ray);
+    return bvh.occluded(ray, tmin, tmax,
+        [&](uint32_t i, const Ray &r, float t0, float t1) {
+            const uint32_t *idx = indices + 3 * bvh.primitive(i);
+            float t, b[3];
+            return intersect_triangle(wr, positions[idx[0]], positions[idx[1]], positions[idx[2]], t0, t1, t, b);
+        });
+}
+
+size_t TriangleMesh::memory_size() const
+{
+    size_t vertex_size = sizeof(Vec3) + (normals ? sizeof(Vec3) : 0) + (uvs ? 2 * sizeof(float) : 0);
+    return n_vertices * vertex_size + 3 * n_triangles * sizeof(uint32_t)
+        + bvh.node_count() * sizeof(BVHFlatNode) + bvh.index_count() * sizeof(uint32_t);
+}
@@ -0,0 +1,97 @@
+#pragma once
+
+#include "hitable.h"
+#include "ray.h"
+#include "bvh.h"
+
+#include <stdint.h>
+#include <vector>
+
+class Material;
+
+// Vertex attributes and 32-bit triangle indices. Normals and uvs are
+// optional, when present they have one entry (two floats for uvs) per
+// position.
+struct MeshBuffers
+{
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<float> uvs;
+    std::vector<uint32_t> indices;
+};
+
+// Per ray constants of the watertight ray/triangle test (Woop, Benthin and
+// Wald, "Watertight Ray/Triangle Intersection", JCGT 2013)
+struct WatertightRay
+{
+    WatertightRay(const Ray &ray)
+    {
+        Vec3 d = ray.direction();
+        kz = 0;
+        if (fabs(d[1]) > fabs(d[kz])) kz = 1;
+        if (fabs(d[2]) > fabs(d[kz])) kz = 2;
+        kx = (kz + 1) % 3;
+        ky = (kx + 1) % 3;
+        // keep the winding of the projected triangle
+        if (d[kz] < 0.0f) {
+            std::swap(kx, ky);
+        }
+        sx = d[kx] / d[kz];
+        sy = d[ky] / d[kz];
+        sz = 1.0f / d[kz];
+        origin = ray.origin();
+    }
+
+    Vec3 origin;
+    int kx, ky, kz;
+    float sx, sy, sz;
+};
+
+// returns the distance and the barycentric weights of v0, v1, v2 on a hit
+bool intersect_triangle(const WatertightRay &wr, const Vec3 &v0, const Vec3 &v1, const Vec3 &v2,
+                        float tmin, float tmax, float &t, float b[3]);
+
+void triangle_bounds(const Vec3 *positions, const uint32_t *indices, uint32_t n_triangles, std::vector<AABB> &boxes);
+
+// Triangles sharing vertex buffers, with their own BVH over single
+// triangles. The attribute arrays are views, they may point to memory the
+// mesh does not own.
+class TriangleMesh : public Hitable
+{
+public:
+    TriangleMesh(MeshBuffers &&buffers, Material *_material, const BVHSettings &settings = BVHSettings(),
+                 const char *cache_dir = nullptr);
+
+    virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override;
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override;
+
+    virtual bool bounding_box(AABB &box) const override
+    {
+        return bvh.bounds(box);
+    }
+
+    uint32_t triangle_count() const { return n_triangles; }
+
+    // bytes used by the geometry and its BVH
+    size_t memory_size() const;
+
+protected:
+    // for meshes whose arrays are set up by a subclass
+    TriangleMesh(Material *_material) : positions(nullptr), normals(nullptr), uvs(nullptr), indices(nullptr),
+        n_vertices(0), n_triangles(0), material(_material) { }
+
+    void build_bvh(const BVHSettings &settings, const char *cache_dir);
+
+    MeshBuffers owned;
+
+    const Vec3 *positions;
+    const Vec3 *normals;
+    const float *uvs;
+    const uint32_t *indices;
+    uint32_t n_vertices;
+    uint32_t n_triangles;
+
+    BVHTree bvh;
+    Material *material;
+};
@@ -0,0 +1,192 @@
+#include "mesh_file.h"
+#include "mapped_file.h"
+
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char mesh_magic[8] = { 'R', 'T', 'M', 'E', 'S', 'H', 0, 0 };
+const uint32_t mesh_version = 1;
+
+enum MeshFlags
+{
+    MESH_HAS_NORMALS = 1,
+    MESH_HAS_UVS = 2,
+    MESH_HAS_BVH = 4
+};
+
+struct MeshFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t flags;
+    uint32_t n_vertices;
+    uint32_t n_triangles;
+    uint64_t positions_offset;
+    uint64_t normals_offset;
+    uint64_t uvs_offset;
+    uint64_t indices_offset;
+    uint64_t bvh_nodes_offset;
+    uint64_t bvh_indices_offset;
+    uint32_t bvh_node_count;
+    uint32_t bvh_index_count;
+};
+
+uint64_t align_up(uint64_t x)
+{
+    return (x + 63) & ~uint64_t(63);
+}
+
+bool block_fits(uint64_t offset, uint64_t size, size_t file_size)
+{
+    return offset % 64 == 0 && offset <= file_size && size <= file_size - offset;
+}
+
+class MappedMesh : public TriangleMesh
+{
+public:
+    MappedMesh(Material *_material) : TriangleMesh(_material) { }
+
+    bool open(const char *path, const BVHSettings &settings, const char *cache_dir);
+
+private:
+    MappedFile file;
+};
+
+bool MappedMesh::open(const char *path, const BVHSettings &settings, const char *cache_dir)
+{
+    if (!file.open(path) || file.size() < sizeof(MeshFileHeader)) {
+        return false;
+    }
+
+    const uint8_t *base = static_cast<const uint8_t *>(file.data());
+    MeshFileHeader header;
+    memcpy(&header, base, sizeof(header));
+    if (memcmp(header.magic, mesh_magic, sizeof(mesh_magic)) != 0 || header.version != mesh_version) {
+        return false;
+    }
+
+    uint64_t nv = header.n_vertices;
+    uint64_t nt = header.n_triangles;
+    if (!block_fits(header.positions_offset, nv * sizeof(Vec3), file.size())
+        || !block_fits(header.indices_offset, 3 * nt * sizeof(uint32_t), file.size())
+        || ((header.flags & MESH_HAS_NORMALS) && !block_fits(header.normals_offset, nv * sizeof(Vec3), file.size()))
+        || ((header.flags & MESH_HAS_UVS) && !block_fits(header.uvs_offset, 2 * nv * sizeof(float), file.size()))) {
+        return false;
+    }
+
+    positions = reinterpret_cast<const Vec3 *>(base + header.positions_offset);
+    normals = (header.flags & MESH_HAS_NORMALS) ? reinterpret_cast<const Vec3 *>(base + header.normals_offset) : nullptr;
+    uvs = (header.flags & MESH_HAS_UVS) ? reinterpret_cast<const float *>(base + header.uvs_offset) : nullptr;
+    indices = reinterpret_cast<const uint32_t *>(base + header.indices_offset);
+    n_vertices = header.n_vertices;
+    n_triangles = header.n_triangles;
+
+    // one sequential pass, it keeps a damaged file from reading out of bounds
+    for (uint64_t i = 0; i < 3 * nt; ++i) {
+        if (indices[i] >= n_vertices) {
+            return false;
+        }
+    }
+
+    if (header.flags & MESH_HAS_BVH) {
+        bool ok = block_fits(header.bvh_nodes_offset, uint64_t(header.bvh_node_count) * sizeof(BVHFlatNode), file.size())
+            && block_fits(header.bvh_indices_offset, uint64_t(header.bvh_index_count) * sizeof(uint32_t), file.size())
+            && bvh.attach(reinterpret_cast<const BVHFlatNode *>(base + header.bvh_nodes_offset), header.bvh_node_count,
+                          reinterpret_cast<const uint32_t *>(base + header.bvh_indices_offset), header.bvh_index_count,
+                          n_triangles);
+        if (!ok) {
+            return false;
+        }
+    } else {
+        build_bvh(settings, cache_dir);
+    }
+
+    return true;
+}
+
+} // namespace
+
+bool write_mesh_file(const char *path, const MeshBuffers &mesh, const BVHTree *bvh)
+{
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, mesh_magic, sizeof(mesh_magic));
+    header.version = mesh_version;
+    header.n_vertices = mesh.positions.size();
+    header.n_triangles = mesh.indices.size() / 3;
+
+    bool has_normals = !mesh.normals.empty();
+    bool has_uvs = !mesh.uvs.empty();
+    bool has_bvh = bvh && bvh->node_count() > 0;
+    header.flags = (has_normals ? MESH_HAS_NORMALS : 0) | (has_uvs ? MESH_HAS_UVS : 0) | (has_bvh ? MESH_HAS_BVH : 0);
+
+    uint64_t offset = align_up(sizeof(header));
+    header.positions_offset = offset;
+    offset = align_up(offset + mesh.positions.size() * sizeof(Vec3));
+    if (has_normals) {
+        header.normals_offset = offset;
+        offset = align_up(offset + mesh.normals.size() * sizeof(Vec3));
+    }
+    if (has_uvs) {
+        header.uvs_offset = offset;
+        offset = align_up(offset + mesh.uvs.size() * sizeof(float));
+    }
+    header.indices_offset = offset;
+    offset = align_up(offset + mesh.indices.size() * sizeof(uint32_t));
+    if (has_bvh) {
+        header.bvh_node_count = bvh->node_count();
+        header.bvh_index_count = bvh->index_count();
+        header.bvh_nodes_offset = offset;
+        offset = align_up(offset + bvh->node_count() * sizeof(BVHFlatNode));
+        header.bvh_indices_offset = offset;
+    }
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        std::cerr << "Error: can't write " << path << std::endl;
+        return false;
+    }
+
+    uint64_t written = 0;
+    bool ok = true;
+    auto put = [&](uint64_t at, const void *data, uint64_t size) {
+        static const char zeros[64] = { 0 };
+        ok = ok && (at == written || fwrite(zeros, at - written, 1, f) == 1);
+        ok = ok && (size == 0 || fwrite(data, size, 1, f) == 1);
+        written = at + size;
+    };
+
+    put(0, &header, sizeof(header));
+    put(header.positions_offset, mesh.positions.data(), mesh.positions.size() * sizeof(Vec3));
+    if (has_normals) {
+        put(header.normals_offset, mesh.normals.data(), mesh.normals.size() * sizeof(Vec3));
+    }
+    if (has_uvs) {
+        put(header.uvs_offset, mesh.uvs.data(), mesh.uvs.size() * sizeof(float));
+    }
+    put(header.indices_offset, mesh.indices.data(), mesh.indices.size() * sizeof(uint32_t));
+    if (has_bvh) {
+        put(header.bvh_nodes_offset, bvh->node_data(), uint64_t(bvh->node_count()) * sizeof(BVHFlatNode));
+        put(header.bvh_indices_offset, bvh->index_data(), uint64_t(bvh->index_count()) * sizeof(uint32_t));
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        std::cerr << "Error: failed writing " << path << std::endl;
+        remove(path);
+    }
+    return ok;
+}
+
+TriangleMesh *load_mesh_file(const char *path, Material *material, const BVHSettings &settings, const char *cache_dir)
+{
+    MappedMesh *mesh = new MappedMesh(material);
+    if (!mesh->open(path, settings, cache_dir)) {
+        delete mesh;
+        return nullptr;
+    }
+    return mesh;
+}
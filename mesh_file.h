@@ -0,0 +1,17 @@
+#pragma once
+
+#include "mesh.h"
+
+// Binary mesh container (.rtmesh): a header followed by 64-byte aligned
+// blocks of positions, optional normals and uvs, triangle indices and an
+// optional prebuilt BVH. Loading maps the file and uses the blocks in
+// place, so nothing is parsed or copied.
+
+// `bvh` may be null to leave the tree out of the file
+bool write_mesh_file(const char *path, const MeshBuffers &mesh, const BVHTree *bvh);
+
+// returns null if the file can't be mapped or is inconsistent, which the
+// caller reports unless it has a fallback; without a stored BVH the tree
+// is built (or read from `cache_dir`) as for other meshes
+TriangleMesh *load_mesh_file(const char *path, Material *material, const BVHSettings &settings = BVHSettings(),
+                             const char *cache_dir = nullptr);
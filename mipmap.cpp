@@ -0,0 +1,191 @@
+#include "mipmap.h"
+
+#include <algorithm>
+#include <string.h>
+#include <math.h>
+
+namespace {
+
+// the texel averaging the 2x2 texels a, b, c, d of the level above
+uint8_t average(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+{
+    return (a + b + c + d + 2) / 4;
+}
+
+float average(float a, float b, float c, float d)
+{
+    return 0.25f * (a + b + c + d);
+}
+
+// repeat addressing, `i` modulo `n` for negative `i` too
+int wrap(int i, int n)
+{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+void store(uint8_t *out, const uint8_t *in, int n)
+{
+    memcpy(out, in, n);
+}
+
+void store(uint8_t *out, const float *in, int n)
+{
+    for (int k = 0; k < n; ++k) {
+        uint16_t h = float_to_half(in[k]);
+        memcpy(out + 2 * k, &h, sizeof(h));
+    }
+}
+
+} // namespace
+
+MipMap::MipMap(const uint8_t *data, int _width, int _height, int nc)
+: texel_format(RGB8), texel_bytes(3), cache(nullptr), file(-1), tiles_offset(0)
+{
+    layout(_width, _height);
+    build(data, nc);
+}
+
+MipMap::MipMap(const float *data, int _width, int _height, int nc)
+: texel_format(RGB16F), texel_bytes(6), cache(nullptr), file(-1), tiles_offset(0)
+{
+    layout(_width, _height);
+    build(data, nc);
+}
+
+MipMap::MipMap(int _width, int _height, Format _format, MappedFile &mapping, uint64_t offset)
+: texel_format(_format), texel_bytes(_format == RGB8 ? 3 : 6), cache(nullptr), file(-1), tiles_offset(0)
+{
+    layout(_width, _height);
+    file_mapping.swap(mapping);
+    tiles = static_cast<const uint8_t *>(file_mapping.data()) + offset;
+}
+
+MipMap::MipMap(int _width, int _height, Format _format, TextureCache *_cache, int _file, uint64_t _tiles_offset)
+: texel_format(_format), texel_bytes(_format == RGB8 ? 3 : 6), tiles(nullptr), cache(_cache), file(_file),
+  tiles_offset(_tiles_offset)
+{
+    layout(_width, _height);
+}
+
+template<typename T>
+void MipMap::build(const T *data, int nc)
+{
+    texels.resize(tile_count() * tile_bytes());
+    tiles = texels.data();
+
+    // the levels are filtered row by row and then cut in tiles; grey and
+    // grey-alpha images are expanded, alpha is dropped
+    const Level &top = pyramid[0];
+    std::vector<T> src(3 * size_t(top.width) * top.height);
+    for (size_t k = 0; k < size_t(top.width) * top.height; ++k) {
+        for (int c = 0; c < 3; ++c) {
+            src[3 * k + c] = data[nc * k + (nc >= 3 ? c : 0)];
+        }
+    }
+
+    std::vector<T> dst;
+    for (size_t l = 0; l < pyramid.size(); ++l) {
+        const Level &level = pyramid[l];
+        for (int j = 0; j < level.height; ++j) {
+            for (int ti = 0; ti < level.tiles_x; ++ti) {
+                int i = ti * tile_size;
+                int n = std::min(tile_size, level.width - i);
+                uint32_t index = level.first_tile + (j >> tile_shift) * level.tiles_x + ti;
+                uint8_t *out = &texels[index * tile_bytes() + texel_bytes * (j & (tile_size - 1)) * tile_size];
+                store(out, &src[3 * (size_t(j) * level.width + i)], 3 * n);
+            }
+        }
+
+        if (l + 1 == pyramid.size()) {
+            break;
+        }
+
+        // the last row or column of an odd size is dropped, as in the
+        // usual power of two pyramids
+        const Level &next = pyramid[l + 1];
+        dst.resize(3 * size_t(next.width) * next.height);
+        int di = level.width > 1 ? 1 : 0;
+        int dj = level.height > 1 ? 1 : 0;
+        for (int j = 0; j < next.height; ++j) {
+            for (int i = 0; i < next.width; ++i) {
+                const T *row0 = &src[3 * (size_t(2 * j) * level.width + 2 * i)];
+                const T *row1 = row0 + 3 * dj * level.width;
+                T *out = &dst[3 * (size_t(j) * next.width + i)];
+                for (int c = 0; c < 3; ++c) {
+                    out[c] = average(row0[c], row0[3 * di + c], row1[c], row1[3 * di + c]);
+                }
+            }
+        }
+        src.swap(dst);
+    }
+}
+
+void MipMap::layout(int _width, int _height)
+{
+    Level level = { _width, _height, 0, 0, 0 };
+    for (;;) {
+        level.tiles_x = (level.width + tile_size - 1) >> tile_shift;
+        level.tiles_y = (level.height + tile_size - 1) >> tile_shift;
+        pyramid.push_back(level);
+        if (level.width == 1 && level.height == 1) {
+            break;
+        }
+        level.first_tile += uint32_t(level.tiles_x) * level.tiles_y;
+        level.width = std::max(1, level.width / 2);
+        level.height = std::max(1, level.height / 2);
+    }
+}
+
+Vec3 MipMap::nearest(float u, float v) const
+{
+    const Level &level = pyramid[0];
+    float x = u * level.width;
+    x -= level.width * floorf(x / level.width);
+    int i = wrap(int(x), level.width);
+    int j = std::min(std::max(int((1.0f - v) * level.height), 0), level.height - 1);
+    TileSlot slot;
+    return texel(level, i, j, slot);
+}
+
+Vec3 MipMap::bilinear(int l, float u, float v) const
+{
+    const Level &level = pyramid[l];
+    // texel centers are at half integers
+    float x = u * level.width - 0.5f;
+    float y = (1.0f - v) * level.height - 0.5f;
+    float x0 = floorf(x);
+    float y0 = floorf(y);
+    float fx = x - x0;
+    float fy = y - y0;
+
+    // u repeats, so that the seam where u = 0 meets u = 1 on spheres
+    // blends across it; v clamps
+    x0 -= level.width * floorf(x0 / level.width);
+    int i0 = wrap(int(x0), level.width);
+    int i1 = wrap(i0 + 1, level.width);
+    int j0 = std::min(std::max(int(y0), 0), level.height - 1);
+    int j1 = std::min(std::max(int(y0) + 1, 0), level.height - 1);
+
+    // the four texels are mostly in the same tile, which is then fetched once
+    TileSlot slot;
+    return (1.0f - fy) * ((1.0f - fx) * texel(level, i0, j0, slot) + fx * texel(level, i1, j0, slot))
+         + fy * ((1.0f - fx) * texel(level, i0, j1, slot) + fx * texel(level, i1, j1, slot));
+}
+
+Vec3 MipMap::filtered(float u, float v, float footprint) const
+{
+    // level where one texel spans the footprint
+    float lod = log2f(footprint * std::max(pyramid[0].width, pyramid[0].height));
+    if (!(lod > 0.0f)) {
+        return bilinear(0, u, v);
+    }
+    int last = levels() - 1;
+    if (lod >= last) {
+        return bilinear(last, u, v);
+    }
+
+    int l = int(lod);
+    float f = lod - l;
+    return (1.0f - f) * bilinear(l, u, v) + f * bilinear(l + 1, u, v);
+}
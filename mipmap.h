@@ -0,0 +1,137 @@
+#pragma once
+
+#include "vec3.h"
+#include "half.h"
+#include "mapped_file.h"
+#include "texture_cache.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// Image pyramid of a texture, each level box filtered to half the size of
+// the previous one, down to 1x1. Texels are stored as RGB whatever the
+// channel count of the source, in 8 bits or, for high dynamic range
+// sources, as half floats; lookups repeat in u, clamp in v and follow the
+// texture convention of v going up from the last row.
+//
+// Levels are cut in square tiles, so that the texels of a filtered lookup
+// sit in one or two tiles instead of rows apart. The tiles are either held
+// in memory, or read from a texture file: mapped in place, or paged in
+// through a TextureCache.
+class MipMap
+{
+public:
+    static const int tile_shift = 6;
+    static const int tile_size = 1 << tile_shift;
+
+    enum Format
+    {
+        RGB8,
+        RGB16F
+    };
+
+    struct Level
+    {
+        int width;
+        int height;
+        int tiles_x;
+        int tiles_y;
+        // index of the first tile of the level, tiles go row by row
+        uint32_t first_tile;
+    };
+
+    MipMap(const uint8_t *data, int _width, int _height, int nc);
+
+    // half float texels
+    MipMap(const float *data, int _width, int _height, int nc);
+
+    // Pyramids of texture files, see texture_file.h: tile i is at
+    // `offset` + i * tile_bytes() in `mapping`, which is taken over, or at
+    // `_tiles_offset` + i * tile_bytes() in `_file` of `_cache`
+    MipMap(int _width, int _height, Format _format, MappedFile &mapping, uint64_t offset);
+
+    MipMap(int _width, int _height, Format _format, TextureCache *_cache, int _file, uint64_t _tiles_offset);
+
+    Format format() const { return texel_format; }
+
+    // texels row by row, the tiles on the right and bottom edges of a
+    // level are padded to the full size
+    size_t tile_bytes() const { return tile_size * tile_size * texel_bytes; }
+
+    int levels() const { return int(pyramid.size()); }
+
+    int width(int level) const { return pyramid[level].width; }
+
+    int height(int level) const { return pyramid[level].height; }
+
+    uint32_t tile_count() const
+    {
+        const Level &last = pyramid.back();
+        return last.first_tile + last.tiles_x * last.tiles_y;
+    }
+
+    // texels of tile `index`; those of a paged tile are valid as long as
+    // TextureCache::tile() keeps them
+    const uint8_t *tile(uint32_t index) const
+    {
+        if (!cache) {
+            return tiles + index * tile_bytes();
+        }
+        return cache->tile(file, index, tiles_offset + index * tile_bytes(), tile_bytes());
+    }
+
+    // nearest texel of the finest level
+    Vec3 nearest(float u, float v) const;
+
+    Vec3 bilinear(int level, float u, float v) const;
+
+    // Trilinear lookup for a footprint `footprint` wide in uv units, i.e.
+    // between the two levels whose texels are closest to that size;
+    // bilinear in the finest level for footprints smaller than its texels.
+    Vec3 filtered(float u, float v, float footprint) const;
+
+private:
+    // the last tile read by a lookup, reused while its texels are in it
+    struct TileSlot
+    {
+        TileSlot() : index(UINT32_MAX), data(nullptr) { }
+
+        uint32_t index;
+        const uint8_t *data;
+    };
+
+    // sizes and tiles of the levels
+    void layout(int _width, int _height);
+
+    // fills `texels` from 8-bit or float data
+    template<typename T>
+    void build(const T *data, int nc);
+
+    Vec3 texel(const Level &level, int i, int j, TileSlot &slot) const
+    {
+        uint32_t index = level.first_tile + (j >> tile_shift) * level.tiles_x + (i >> tile_shift);
+        if (index != slot.index) {
+            slot.data = tile(index);
+            slot.index = index;
+        }
+        const uint8_t *t = slot.data + texel_bytes * ((j & (tile_size - 1)) * tile_size + (i & (tile_size - 1)));
+        if (texel_format == RGB8) {
+            return Vec3(t[0], t[1], t[2]) * (1.0f / 255.0f);
+        }
+        uint16_t h[3];
+        memcpy(h, t, sizeof(h));
+        return Vec3(half_to_float(h[0]), half_to_float(h[1]), half_to_float(h[2]));
+    }
+
+    std::vector<Level> pyramid;
+    Format texel_format;
+    int texel_bytes;
+    // all the tiles of an in-memory or mapped pyramid, null for a paged one
+    const uint8_t *tiles;
+    std::vector<uint8_t> texels;
+    MappedFile file_mapping;
+    TextureCache *cache;
+    int file;
+    uint64_t tiles_offset;
+};
@@ -0,0 +1,53 @@
+#include "obj_loader.h"
+#include "mesh_file.h"
+
+#include <iostream>
+#include <string.h>
+
+// Convert a Wavefront OBJ file to the mappable .rtmesh format, with a
+// prebuilt BVH unless --no-bvh is given
+int main(int argc, char *argv[])
+{
+    bool with_bvh = true;
+    const char *input = nullptr;
+    const char *output = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--no-bvh") == 0) {
+            with_bvh = false;
+        } else if (!input) {
+            input = argv[i];
+        } else if (!output) {
+            output = argv[i];
+        }
+    }
+
+    if (!input || !output) {
+        std::cerr << "usage: " << argv[0] << " [--no-bvh] input.obj output.rtmesh" << std::endl;
+        return 1;
+    }
+
+    MeshBuffers mesh;
+    if (!load_obj(input, mesh)) {
+        return 1;
+    }
+
+    BVHTree bvh;
+    if (with_bvh) {
+        std::vector<AABB> boxes;
+        triangle_bounds(mesh.positions.data(), mesh.indices.data(), mesh.indices.size() / 3, boxes);
+        bvh.build(boxes, BVHSettings());
+    }
+
+    if (!write_mesh_file(output, mesh, with_bvh ? &bvh : nullptr)) {
+        return 1;
+    }
+
+    std::cout << input << ": " << mesh.positions.size() << " vertices, " << mesh.indices.size() / 3 << " triangles"
+              << (mesh.normals.empty() ? "" : ", normals") << (mesh.uvs.empty() ? "" : ", uvs");
+    if (with_bvh) {
+        std::cout << ", " << bvh.node_count() << " BVH nodes";
+    }
+    std::cout << std::endl;
+
+    return 0;
+}
@@ -0,0 +1,292 @@
+#include "obj_loader.h"
+
+#include <iostream>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+namespace {
+
+struct CornerKey
+{
+    int v, vt, vn;
+
+    bool operator==(const CornerKey &o) const { return v == o.v && vt == o.vt && vn == o.vn; }
+};
+
+struct CornerHash
+{
+    size_t operator()(const CornerKey &k) const
+    {
+        return size_t(k.v) * 73856093u ^ size_t(k.vt) * 19349663u ^ size_t(k.vn) * 83492791u;
+    }
+};
+
+inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+}
+
+inline bool is_digit(char c)
+{
+    return c >= '0' && c <= '9';
+}
+
+inline const char *skip_space(const char *s, const char *end)
+{
+    while (s < end && is_space(*s)) ++s;
+    return s;
+}
+
+// strtof is locale dependent and needs a terminated string, this one
+// parses in place and is precise enough for float output
+bool parse_float(const char *&s, const char *end, float &out)
+{
+    static const double powers[] = { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10,
+                                     1e11, 1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18 };
+    s = skip_space(s, end);
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        ++s;
+    }
+
+    double mantissa = 0.0;
+    int exponent = 0;
+    bool digits = false;
+    while (s < end && is_digit(*s)) {
+        mantissa = 10.0 * mantissa + (*s++ - '0');
+        digits = true;
+    }
+    if (s < end && *s == '.') {
+        ++s;
+        while (s < end && is_digit(*s)) {
+            mantissa = 10.0 * mantissa + (*s++ - '0');
+            --exponent;
+            digits = true;
+        }
+    }
+    if (!digits) {
+        return false;
+    }
+
+    if (s < end && (*s == 'e' || *s == 'E')) {
+        ++s;
+        int sign = 1;
+        if (s < end && (*s == '-' || *s == '+')) {
+            sign = (*s == '-') ? -1 : 1;
+            ++s;
+        }
+        int e = 0;
+        while (s < end && is_digit(*s)) {
+            e = 10 * e + (*s++ - '0');
+        }
+        exponent += sign * e;
+    }
+
+    if (exponent < 0 && exponent >= -18) {
+        mantissa /= powers[-exponent];
+    } else if (exponent > 0 && exponent <= 18) {
+        mantissa *= powers[exponent];
+    } else if (exponent != 0) {
+        mantissa *= pow(10.0, exponent);
+    }
+
+    out = float(negative ? -mantissa : mantissa);
+    return true;
+}
+
+bool parse_int(const char *&s, const char *end, int &out)
+{
+    bool negative = false;
+    if (s < end && (*s == '-' || *s == '+')) {
+        negative = (*s == '-');
+        ++s;
+    }
+    if (s >= end || !is_digit(*s)) {
+        return false;
+    }
+    // indices past INT_MAX are errors, not values to wrap around
+    int value = 0;
+    while (s < end && is_digit(*s)) {
+        int digit = *s++ - '0';
+        if (value > (INT_MAX - digit) / 10) {
+            return false;
+        }
+        value = 10 * value + digit;
+    }
+    out = negative ? -value : value;
+    return true;
+}
+
+class ObjParser
+{
+public:
+    ObjParser(MeshBuffers &_mesh) : mesh(_mesh), has_uvs(false), has_normals(false) { }
+
+    bool parse_line(const char *s, const char *end, int line_no);
+
+    void finish()
+    {
+        if (!has_uvs) mesh.uvs.clear();
+        if (!has_normals) mesh.normals.clear();
+    }
+
+private:
+    // 1-based or negative (relative) OBJ index to a 0-based one, -1 if invalid
+    static int resolve(int index, size_t count)
+    {
+        int i = index > 0 ? index - 1 : int(count) + index;
+        return (index != 0 && i >= 0 && size_t(i) < count) ? i : -1;
+    }
+
+    bool add_corner(const char *&s, const char *end, uint32_t &vertex);
+
+    MeshBuffers &mesh;
+    std::vector<Vec3> positions;
+    std::vector<Vec3> normals;
+    std::vector<float> uvs;
+    std::unordered_map<CornerKey, uint32_t, CornerHash> vertices;
+    std::vector<uint32_t> polygon;
+    bool has_uvs;
+    bool has_normals;
+};
+
+bool ObjParser::add_corner(const char *&s, const char *end, uint32_t &vertex)
+{
+    int v, vt = 0, vn = 0;
+    if (!parse_int(s, end, v)) return false;
+    if (s < end && *s == '/') {
+        ++s;
+        if (s < end && *s != '/' && !parse_int(s, end, vt)) return false;
+        if (s < end && *s == '/') {
+            ++s;
+            if (!parse_int(s, end, vn)) return false;
+        }
+    }
+
+    CornerKey key = { resolve(v, positions.size()), vt ? resolve(vt, uvs.size() / 2) : -1,
+                      vn ? resolve(vn, normals.size()) : -1 };
+    if (key.v < 0 || (vt && key.vt < 0) || (vn && key.vn < 0)) {
+        return false;
+    }
+
+    auto it = vertices.find(key);
+    if (it != vertices.end()) {
+        vertex = it->second;
+        return true;
+    }
+
+    vertex = mesh.positions.size();
+    vertices.insert(std::make_pair(key, vertex));
+    mesh.positions.push_back(positions[key.v]);
+    mesh.uvs.push_back(key.vt >= 0 ? uvs[2 * key.vt] : 0.0f);
+    mesh.uvs.push_back(key.vt >= 0 ? uvs[2 * key.vt + 1] : 0.0f);
+    mesh.normals.push_back(key.vn >= 0 ? normals[key.vn] : Vec3(0.0));
+    has_uvs |= key.vt >= 0;
+    has_normals |= key.vn >= 0;
+    return true;
+}
+
+bool ObjParser::parse_line(const char *s, const char *end, int line_no)
+{
+    s = skip_space(s, end);
+    if (s == end || *s == '#') {
+        return true;
+    }
+
+    const char *keyword = s;
+    while (s < end && !is_space(*s)) ++s;
+    size_t len = s - keyword;
+
+    bool ok = true;
+    if (len == 1 && keyword[0] == 'v') {
+        float x, y, z;
+        ok = parse_float(s, end, x) && parse_float(s, end, y) && parse_float(s, end, z);
+        positions.push_back(Vec3(x, y, z));
+    } else if (len == 2 && keyword[0] == 'v' && keyword[1] == 'n') {
+        float x, y, z;
+        ok = parse_float(s, end, x) && parse_float(s, end, y) && parse_float(s, end, z);
+        normals.push_back(Vec3(x, y, z));
+    } else if (len == 2 && keyword[0] == 'v' && keyword[1] == 't') {
+        float u, v = 0.0f;
+        ok = parse_float(s, end, u);
+        parse_float(s, end, v);
+        uvs.push_back(u);
+        uvs.push_back(v);
+    } else if (len == 1 && keyword[0] == 'f') {
+        polygon.clear();
+        while (ok && (s = skip_space(s, end)) < end) {
+            uint32_t vertex;
+            ok = add_corner(s, end, vertex);
+            polygon.push_back(vertex);
+        }
+        ok = ok && polygon.size() >= 3;
+        for (size_t k = 2; ok && k < polygon.size(); ++k) {
+            mesh.indices.push_back(polygon[0]);
+            mesh.indices.push_back(polygon[k - 1]);
+            mesh.indices.push_back(polygon[k]);
+        }
+    }
+
+    if (!ok) {
+        std::cerr << "Error: malformed OBJ statement at line " << line_no << std::endl;
+    }
+    return ok;
+}
+
+} // namespace
+
+bool load_obj(const char *path, MeshBuffers &mesh)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) {
+        std::cerr << "Error: can't open " << path << std::endl;
+        return false;
+    }
+
+    mesh = MeshBuffers();
+    ObjParser parser(mesh);
+
+    // read in blocks and parse every complete line, the tail of a block is
+    // carried over to the next one
+    std::vector<char> buffer(1 << 20);
+    size_t filled = 0;
+    bool eof = false;
+    bool ok = true;
+    int line_no = 0;
+    while (ok && (!eof || filled > 0)) {
+        if (!eof) {
+            if (filled == buffer.size()) {
+                buffer.resize(2 * buffer.size());
+            }
+            size_t n = fread(buffer.data() + filled, 1, buffer.size() - filled, f);
+            filled += n;
+            eof = (n == 0);
+        }
+
+        const char *data = buffer.data();
+        size_t start = 0;
+        while (ok && start < filled) {
+            const char *nl = static_cast<const char *>(memchr(data + start, '\n', filled - start));
+            if (!nl && !eof) break;
+            size_t line_end = nl ? size_t(nl - data) : filled;
+            ok = parser.parse_line(data + start, data + line_end, ++line_no);
+            start = nl ? line_end + 1 : filled;
+        }
+
+        memmove(buffer.data(), data + start, filled - start);
+        filled -= start;
+    }
+    fclose(f);
+
+    if (!ok) {
+        mesh = MeshBuffers();
+        return false;
+    }
+
+    parser.finish();
+    return true;
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "mesh.h"
+
+// Read the geometry of a Wavefront OBJ file: positions, normals, texture
+// coordinates and faces (polygons are fan triangulated). Everything else
+// (groups, materials, smoothing) is ignored. Corners sharing the same
+// v/vt/vn triple become a single vertex.
+bool load_obj(const char *path, MeshBuffers &mesh);
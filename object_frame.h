@@ -1,21 +1,24 @@
 #pragma once
 
 #include "hitable.h"
+#include "ray.h"
 #include "mat4.h"
+#include "simd.h"
 
 #include <math.h>
 #include <iostream>
 
+// Instance of a hitable under an affine transform. Rays are brought into
+// the object's space with the cached inverse; since the direction is not
+// renormalized the hit distance is the same in both spaces.
 class ObjectFrame : public Hitable
 {
 public:
-    ObjectFrame(Hitable *_hitable)
-    {
-        hitable = _hitable;
-        transform.setIdentity();
-    }
+    ObjectFrame(Hitable *_hitable) : hitable(_hitable) { }
 
-    void set_transform(float rx, float ry, float rz, float tx, float ty, float tz)
+    // rotations in degrees around x, then y, then z (applied after the
+    // scaling), then the translation
+    void set_transform(float rx, float ry, float rz, float tx, float ty, float tz, const Vec3 &scale = Vec3(1.0))
     {
         float cx = cos(rx*M_PI/180);
         float sx = sin(rx*M_PI/180);
@@ -23,13 +26,19 @@ public:
         float sy = sin(ry*M_PI/180);
         float cz = cos(rz*M_PI/180);
         float sz = sin(rz*M_PI/180);
-    
-        Mat4 &d = transform;
+
+        Mat4 d;
 
         d[0][0] = cy*cz;            d[0][1] = -cy*sz;           d[0][2] = sy;
         d[1][0] = cx*sz + cz*sx*sy; d[1][1] = cx*cz - sx*sy*sz; d[1][2] = -cy*sx;
         d[2][0] = sx*sz - cx*cz*sy; d[2][1] = cz*sx + cx*sy*sz; d[2][2] = cx*cy;
 
+        for (int i = 0; i < 3; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                d[i][j] *= scale[j];
+            }
+        }
+
         d[0][3] = tx; // d[0][0] * tx + d[1][0] * ty + d[2][0] * tz;
         d[1][3] = ty; //d[0][1] * tx + d[1][1] * ty + d[2][1] * tz;
         d[2][3] = tz; // d[0][2] * tx + d[1][2] * ty + d[2][2] * tz;
@@ -37,26 +46,49 @@ public:
         d[3][1] = 0.0;
         d[3][2] = 0.0;
         d[3][3] = 1.0;
+
+        set_transform(d);
+    }
+
+    // any invertible affine matrix, the last row is ignored
+    void set_transform(const Mat4 &M)
+    {
+        to_world = Affine3(M);
+        to_local = to_world.inverse();
     }
 
     virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override
     {
-        Vec3 torig = apply_inv_transform_point(transform, ray.origin());
-        Vec3 tdir = apply_inv_transform_vec(transform, ray.direction());
-    
+        Vec3A torig = to_local.transform_point(ray.origin_a());
+        Vec3A tdir = to_local.transform_vector(ray.direction_a());
+
         if (hitable->hit(Ray(torig, tdir), tmin, tmax, hit)) {
-            hit.p = apply_transform_point(transform, hit.p);
-            hit.normal = apply_transform_vec(transform, hit.normal);
+            // only the hit the object returned is brought back, its point
+            // directly from the world ray
+            hit.p = ray.point_at_parameter(hit.t);
+            // normals transform with the inverse transpose
+            hit.normal = unit_vector(to_local.transpose_transform_vector(Vec3A(hit.normal))).to_vec3();
+            hit.dpdu = to_world.transform_vector(Vec3A(hit.dpdu)).to_vec3();
+            hit.dpdv = to_world.transform_vector(Vec3A(hit.dpdv)).to_vec3();
+            // lengths along the ray scale by |tdir| / |dir| into the object
+            hit.curvature *= sqrtf(dot(tdir, tdir) / dot(ray.direction_a(), ray.direction_a()));
             return true;
         }
 
         return false;
     }
-   
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override
+    {
+        Vec3A torig = to_local.transform_point(ray.origin_a());
+        Vec3A tdir = to_local.transform_vector(ray.direction_a());
+        return hitable->occluded(Ray(torig, tdir), tmin, tmax);
+    }
+
     virtual bool bounding_box(AABB &box) const override
     {
         if (hitable->bounding_box(box)) {
-            box = transform_bounding_box(box, transform);            
+            box = transform_bounding_box(box, to_world);
             return true;
         } else {
             return false;
@@ -65,6 +97,6 @@ public:
 
 private:
     Hitable *hitable;
-    Mat4 transform;
+    Affine3 to_world;
+    Affine3 to_local;
 };
-
@@ -0,0 +1,185 @@
+#pragma once
+
+#include "ray.h"
+#include "simd.h"
+
+#include <stdint.h>
+#include <cmath>
+#include <limits>
+
+// Up to eight rays traced together through a BVH, e.g. the samples of one
+// pixel. The origins and inverse directions are also stored by component so
+// that a node is tested against four rays per instruction. Packet traversal
+// needs all the directions in the same octant, `coherent` tells whether
+// they are; other packets are traced one ray after the other.
+class RayPacket
+{
+public:
+    static const int size = 8;
+
+    RayPacket(const Ray *_rays, int n, float _tmax);
+
+    // bit i set for lanes holding a ray still being traced
+    uint32_t active() const { return lanes; }
+
+    bool is_coherent() const { return coherent; }
+
+    const Ray &ray(int i) const { return rays[i]; }
+
+    float tmax(int i) const { return far[i]; }
+
+    // records a closer hit on lane i
+    void shorten(int i, float t)
+    {
+        far[i] = t;
+        far_max = far[0];
+        for (int k = 1; k < size; ++k) {
+            far_max = far[k] > far_max ? far[k] : far_max;
+        }
+    }
+
+    // drops lane i from the traversal, e.g. once its shadow ray is blocked
+    void retire(int i)
+    {
+        lanes &= ~(1u << i);
+        shorten(i, std::numeric_limits<float>::lowest());
+    }
+
+    // negative direction along `axis`, for coherent packets
+    bool direction_negative(int axis) const { return dir_neg[axis]; }
+
+    // conservative test for the whole packet: false when no ray can hit the
+    // box, from bounds on the origins and inverse directions
+    bool may_hit(const Vec3 &bmin, const Vec3 &bmax, float tmin) const;
+
+    // slab test of every lane against the box, coherent packets only
+    uint32_t hit_mask(const Vec3 &bmin, const Vec3 &bmax, float tmin) const;
+
+private:
+    // min and max without the NaN handling of fmin and fmax
+    static float lower(float a, float b) { return a < b ? a : b; }
+
+    static float upper(float a, float b) { return a > b ? a : b; }
+
+    Ray rays[size];
+    alignas(16) float ox[size];
+    alignas(16) float oy[size];
+    alignas(16) float oz[size];
+    alignas(16) float ix[size];
+    alignas(16) float iy[size];
+    alignas(16) float iz[size];
+    alignas(16) float far[size];
+    float far_max;
+    uint32_t lanes;
+    bool coherent;
+    bool dir_neg[3];
+
+    // packet bounds for may_hit, only set when every inverse direction is
+    // finite since infinities turn the interval products into NaNs
+    bool bounded;
+    Vec3 o_lo, o_hi;
+    Vec3 i_lo, i_hi;
+};
+
+inline RayPacket::RayPacket(const Ray *_rays, int n, float _tmax)
+: lanes((1u << n) - 1), coherent(true), bounded(true)
+{
+    Vec3A dir0 = _rays[0].direction_a();
+    for (int a = 0; a < 3; ++a) {
+        dir_neg[a] = std::signbit(dir0[a]);
+    }
+
+    o_lo = o_hi = _rays[0].origin();
+    Vec3 inv0(1.0f / dir0.x(), 1.0f / dir0.y(), 1.0f / dir0.z());
+    i_lo = i_hi = inv0;
+
+    for (int k = 0; k < size; ++k) {
+        // unused lanes repeat the first ray and never hit
+        const Ray &r = _rays[k < n ? k : 0];
+        rays[k] = r;
+        Vec3 o = r.origin();
+        Vec3 d = r.direction();
+        Vec3 inv(1.0f / d.x(), 1.0f / d.y(), 1.0f / d.z());
+        ox[k] = o.x(); oy[k] = o.y(); oz[k] = o.z();
+        ix[k] = inv.x(); iy[k] = inv.y(); iz[k] = inv.z();
+        far[k] = k < n ? _tmax : std::numeric_limits<float>::lowest();
+
+        for (int a = 0; a < 3; ++a) {
+            if (std::signbit(d[a]) != dir_neg[a]) {
+                coherent = false;
+            }
+            if (!std::isfinite(inv[a])) {
+                bounded = false;
+            }
+            o_lo[a] = lower(o_lo[a], o[a]);
+            o_hi[a] = upper(o_hi[a], o[a]);
+            i_lo[a] = lower(i_lo[a], inv[a]);
+            i_hi[a] = upper(i_hi[a], inv[a]);
+        }
+    }
+    far_max = _tmax;
+}
+
+inline bool RayPacket::may_hit(const Vec3 &bmin, const Vec3 &bmax, float tmin) const
+{
+    if (!bounded) {
+        return true;
+    }
+
+    // the entry distance of every ray is at least `enter` and the exit
+    // distance at most `leave`
+    float enter = tmin;
+    float leave = far_max;
+    for (int a = 0; a < 3; ++a) {
+        float near_plane = dir_neg[a] ? bmax[a] : bmin[a];
+        float far_plane = dir_neg[a] ? bmin[a] : bmax[a];
+
+        // the inverse direction keeps its sign over the packet, so each
+        // bound of a product is reached at a corner of the intervals
+        float n0 = (near_plane - o_hi[a]) * i_lo[a];
+        float n1 = (near_plane - o_hi[a]) * i_hi[a];
+        float n2 = (near_plane - o_lo[a]) * i_lo[a];
+        float n3 = (near_plane - o_lo[a]) * i_hi[a];
+        enter = upper(enter, lower(lower(n0, n1), lower(n2, n3)));
+
+        float f0 = (far_plane - o_hi[a]) * i_lo[a];
+        float f1 = (far_plane - o_hi[a]) * i_hi[a];
+        float f2 = (far_plane - o_lo[a]) * i_lo[a];
+        float f3 = (far_plane - o_lo[a]) * i_hi[a];
+        leave = lower(leave, upper(upper(f0, f1), upper(f2, f3)));
+    }
+    return enter <= leave;
+}
+
+inline uint32_t RayPacket::hit_mask(const Vec3 &bmin, const Vec3 &bmax, float tmin) const
+{
+    Float4 near_x(dir_neg[0] ? bmax.x() : bmin.x());
+    Float4 near_y(dir_neg[1] ? bmax.y() : bmin.y());
+    Float4 near_z(dir_neg[2] ? bmax.z() : bmin.z());
+    Float4 far_x(dir_neg[0] ? bmin.x() : bmax.x());
+    Float4 far_y(dir_neg[1] ? bmin.y() : bmax.y());
+    Float4 far_z(dir_neg[2] ? bmin.z() : bmax.z());
+    Float4 t_min(tmin);
+
+    uint32_t mask = 0;
+    for (int k = 0; k < size; k += 4) {
+        Float4 o_x = Float4::load(ox + k);
+        Float4 o_y = Float4::load(oy + k);
+        Float4 o_z = Float4::load(oz + k);
+        Float4 i_x = Float4::load(ix + k);
+        Float4 i_y = Float4::load(iy + k);
+        Float4 i_z = Float4::load(iz + k);
+
+        // the running bound is the second operand so that a NaN (origin on
+        // a plane parallel to the ray) leaves it unchanged, as in slab_hit
+        Float4 t0 = max((near_x - o_x) * i_x, t_min);
+        t0 = max((near_y - o_y) * i_y, t0);
+        t0 = max((near_z - o_z) * i_z, t0);
+        Float4 t1 = min((far_x - o_x) * i_x, Float4::load(far + k));
+        t1 = min((far_y - o_y) * i_y, t1);
+        t1 = min((far_z - o_z) * i_z, t1);
+
+        mask |= less_equal_mask(t0, t1) << k;
+    }
+    return mask & lanes;
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "vec3.h"
+#include "ray.h"
+#include "hitable.h"
+#include "material.h"
+
+#include <math.h>
+
+// Infinite plane through `point`, kept out of the BVH by Scene. The texture
+// coordinates repeat every `uv_size` units along the plane.
+class Plane : public Hitable
+{
+public:
+    Plane() { }
+
+    Plane(const Vec3 &_point, const Vec3 &_normal, Material *_material, float _uv_size = 1.0)
+    : point(_point), normal(unit_vector(_normal)), material(_material), uv_size(_uv_size)
+    {
+        Vec3 a = fabs(normal.x()) > 0.9 ? Vec3(0.0, 1.0, 0.0) : Vec3(1.0, 0.0, 0.0);
+        tangent = unit_vector(cross(a, normal));
+        bitangent = cross(normal, tangent);
+    }
+
+    virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override
+    {
+        float denom = dot(ray.direction(), normal);
+        if (fabs(denom) < 1e-12f) {
+            return false;
+        }
+
+        float t = dot(point - ray.origin(), normal) / denom;
+        if (t <= tmin || t >= tmax) {
+            return false;
+        }
+
+        hit.p = ray.point_at_parameter(t);
+        hit.normal = normal;
+        hit.t = t;
+        hit.material = material;
+        if (material->needs_uv()) {
+            Vec3 q = (hit.p - point) / uv_size;
+            hit.u = dot(q, tangent) - floor(dot(q, tangent));
+            hit.v = dot(q, bitangent) - floor(dot(q, bitangent));
+            hit.dpdu = uv_size * tangent;
+            hit.dpdv = uv_size * bitangent;
+        } else {
+            hit.u = hit.v = 0.0f;
+            hit.dpdu = hit.dpdv = Vec3(0.0f);
+        }
+        hit.curvature = 0.0f;
+        return true;
+    }
+
+    virtual bool bounding_box(AABB &box) const override
+    {
+        return false;
+    }
+
+private:
+    Vec3 point;
+    Vec3 normal;
+    Vec3 tangent;
+    Vec3 bitangent;
+    Material *material;
+    float uv_size;
+};
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "vec3.h"
+#include "simd.h"
 
 class Ray
 {
@@ -9,13 +10,20 @@ public:
 
     Ray(const Vec3 &_O, const Vec3 &_d) : O(_O), d(_d) { }
 
-    Vec3 origin() const { return O; }
+    Ray(const Vec3A &_O, const Vec3A &_d) : O(_O), d(_d) { }
 
-    Vec3 direction() const { return d; }
+    Vec3 origin() const { return O.to_vec3(); }
 
-    Vec3 point_at_parameter(float t) const { return O + t * d; }
+    Vec3 direction() const { return d.to_vec3(); }
+
+    // the same in SIMD registers
+    const Vec3A &origin_a() const { return O; }
+
+    const Vec3A &direction_a() const { return d; }
+
+    Vec3 point_at_parameter(float t) const { return (O + t * d).to_vec3(); }
 
 private:
-    Vec3 O;
-    Vec3 d;
+    Vec3A O;
+    Vec3A d;
 };
@@ -0,0 +1,186 @@
+#include "scene.h"
+#include "wide_bvh.h"
+#include "trace.h"
+
+#include <algorithm>
+
+constexpr float Scene::large_ratio;
+
+Scene::~Scene()
+{
+    delete accel;
+}
+
+void Scene::add(Hitable *hitable)
+{
+    AABB box;
+    if (hitable->bounding_box(box)) {
+        bounded.push_back(hitable);
+    } else {
+        unbounded.push_back(hitable);
+    }
+}
+
+void Scene::clear()
+{
+    delete accel;
+    accel = nullptr;
+    environment = nullptr;
+    bounded.clear();
+    large.clear();
+    unbounded.clear();
+    pool.clear();
+    allocator.reset();
+}
+
+void Scene::build(const BVHSettings &settings, const char *cache_dir, bool quantized)
+{
+    TRACE_SCOPE("bvh build");
+    large.clear();
+
+    // the median is meaningless for a handful of objects
+    std::vector<Hitable *> elems;
+    if (bounded.size() >= 8) {
+        std::vector<float> diagonals;
+        for (Hitable *h : bounded) {
+            AABB box;
+            h->bounding_box(box);
+            diagonals.push_back((box.max() - box.min()).length());
+        }
+        std::vector<float> sorted = diagonals;
+        std::nth_element(sorted.begin(), sorted.begin() + sorted.size() / 2, sorted.end());
+        float threshold = large_ratio * sorted[sorted.size() / 2];
+
+        for (size_t i = 0; i < bounded.size(); ++i) {
+            if (diagonals[i] > threshold) {
+                large.push_back(bounded[i]);
+            } else {
+                elems.push_back(bounded[i]);
+            }
+        }
+    } else {
+        elems = bounded;
+    }
+
+    delete accel;
+    accel = nullptr;
+    if (!elems.empty()) {
+        if (quantized) {
+            accel = new QuantizedBVH(elems, settings, cache_dir);
+        } else {
+            accel = new LinearBVH(elems, settings, cache_dir);
+        }
+    }
+}
+
+bool Scene::hit(const Ray &ray, float tmin, float tmax, Hit &hit) const
+{
+    // the cheap unbounded tests go first, they shorten the BVH traversal
+    STAT_ADD(primitive_tests, unbounded.size() + large.size());
+    bool got_hit = false;
+    for (Hitable *h : unbounded) {
+        if (h->hit(ray, tmin, tmax, hit)) {
+            tmax = hit.t;
+            got_hit = true;
+        }
+    }
+
+    for (Hitable *h : large) {
+        if (h->hit(ray, tmin, tmax, hit)) {
+            tmax = hit.t;
+            got_hit = true;
+        }
+    }
+
+    if (accel && accel->hit(ray, tmin, tmax, hit)) {
+        got_hit = true;
+    }
+
+    return got_hit;
+}
+
+uint32_t Scene::hit_packet(RayPacket &packet, float tmin, Hit *hits) const
+{
+    STAT_BIND(stats);
+    for (int k = 0; k < RayPacket::size; ++k) {
+        STAT_ADD_TO(stats, primitive_tests, (packet.active() >> k & 1) * (unbounded.size() + large.size()));
+    }
+
+    uint32_t got_hit = 0;
+    for (Hitable *h : unbounded) {
+        got_hit |= h->hit_packet(packet, tmin, hits);
+    }
+
+    for (Hitable *h : large) {
+        got_hit |= h->hit_packet(packet, tmin, hits);
+    }
+
+    if (accel) {
+        got_hit |= accel->hit_packet(packet, tmin, hits);
+    }
+
+    return got_hit;
+}
+
+bool Scene::occluded(const Ray &ray, float tmin, float tmax) const
+{
+    STAT_ADD(primitive_tests, unbounded.size() + large.size());
+    for (Hitable *h : unbounded) {
+        if (h->occluded(ray, tmin, tmax)) {
+            return true;
+        }
+    }
+
+    for (Hitable *h : large) {
+        if (h->occluded(ray, tmin, tmax)) {
+            return true;
+        }
+    }
+
+    return accel && accel->occluded(ray, tmin, tmax);
+}
+
+uint32_t Scene::occluded_packet(RayPacket &packet, float tmin) const
+{
+    STAT_BIND(stats);
+    for (int k = 0; k < RayPacket::size; ++k) {
+        STAT_ADD_TO(stats, primitive_tests, (packet.active() >> k & 1) * (unbounded.size() + large.size()));
+    }
+
+    // the lanes blocked by one hitable are retired before the next
+    uint32_t blocked = 0;
+    for (Hitable *h : unbounded) {
+        blocked |= h->occluded_packet(packet, tmin);
+    }
+
+    for (Hitable *h : large) {
+        blocked |= h->occluded_packet(packet, tmin);
+    }
+
+    if (accel && packet.active()) {
+        blocked |= accel->occluded_packet(packet, tmin);
+    }
+
+    return blocked;
+}
+
+bool Scene::bounding_box(AABB &box) const
+{
+    if (!unbounded.empty()) {
+        return false;
+    }
+
+    bool got_box = false;
+    AABB elem_box;
+    if (accel && accel->bounding_box(elem_box)) {
+        box = elem_box;
+        got_box = true;
+    }
+    for (Hitable *h : large) {
+        h->bounding_box(elem_box);
+        box = got_box ? surrounding_box(box, elem_box) : elem_box;
+        got_box = true;
+    }
+
+    return got_box;
+}
@@ -0,0 +1,93 @@
+#pragma once
+
+#include "hitable.h"
+#include "ray.h"
+#include "bvh.h"
+#include "environment.h"
+#include "arena.h"
+#include "material_pool.h"
+#include "texture_cache.h"
+
+#include <memory>
+#include <vector>
+
+// Top level of the world. Primitives without bounds (planes) are tested
+// analytically, primitives much larger than the rest (e.g. a ground sphere)
+// are kept in a short list, and everything else goes in a BVH so that
+// neither kind inflates the tree's root box.
+//
+// The scene owns an arena where builders place primitives, materials and
+// textures; they are released together with the scene or by clear().
+// Materials and textures should come from materials(), which shares the
+// identical ones. Textures loaded from tiled files are mapped, or paged
+// through texture_cache() once set_texture_cache() was called.
+class Scene : public Hitable
+{
+public:
+    Scene() : pool(allocator), accel(nullptr), environment(nullptr) { }
+
+    ~Scene();
+
+    Scene(const Scene &) = delete;
+
+    Scene& operator=(const Scene &) = delete;
+
+    void add(Hitable *hitable);
+
+    Arena &arena() { return allocator; }
+
+    MaterialPool &materials() { return pool; }
+
+    // bounds the memory of the textures loaded afterwards to `bytes`
+    void set_texture_cache(size_t bytes)
+    {
+        if (!tiles) {
+            tiles.reset(new TextureCache(bytes));
+        } else {
+            tiles->set_capacity(bytes);
+        }
+    }
+
+    // null when tiled textures are mapped
+    TextureCache *texture_cache() const { return tiles.get(); }
+
+    // removes and destroys everything, the scene can then be built again
+    void clear();
+
+    void set_environment(Environment *env) { environment = env; }
+
+    const Environment *get_environment() const { return environment; }
+
+    // sort the primitives and (re)build the acceleration structure
+    void build(const BVHSettings &settings = BVHSettings(), const char *cache_dir = nullptr, bool quantized = false);
+
+    virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override;
+
+    virtual uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits) const override;
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override;
+
+    virtual uint32_t occluded_packet(RayPacket &packet, float tmin) const override;
+
+    virtual bool bounding_box(AABB &box) const override;
+
+    // radiance for rays leaving the scene
+    Vec3 background(const Ray &ray) const
+    {
+        return environment ? environment->value(ray.direction()) : Vec3(0.0);
+    }
+
+    // a primitive whose box diagonal exceeds this many times the median one
+    // is kept out of the BVH
+    static constexpr float large_ratio = 100.0f;
+
+private:
+    Arena allocator;
+    MaterialPool pool;
+    std::unique_ptr<TextureCache> tiles;
+    std::vector<Hitable *> bounded;
+    std::vector<Hitable *> large;
+    std::vector<Hitable *> unbounded;
+    Hitable *accel;
+    Environment *environment;
+};
@@ -0,0 +1,377 @@
+#include "scene_file.h"
+#include "sphere.h"
+#include "plane.h"
+#include "xy_rectangle.h"
+#include "object_frame.h"
+#include "material.h"
+#include "texture.h"
+#include "mesh.h"
+#include "mesh_file.h"
+#include "texture_file.h"
+#include "obj_loader.h"
+#include "stb_image.h"
+
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <stdlib.h>
+#include <string>
+#include <vector>
+
+namespace {
+
+class SceneParser
+{
+public:
+    SceneParser(Scene &_world, Camera &_cam, const char *_path, const char *_cache_dir)
+    : world(_world), arena(_world.arena()), pool(_world.materials()), cam(_cam), path(_path), cache_dir(_cache_dir), pos(0), line_no(0) { }
+
+    bool parse();
+
+private:
+    bool statement(const std::string &keyword);
+
+    bool error(const std::string &message)
+    {
+        std::cerr << path << ":" << line_no << ": " << message << std::endl;
+        return false;
+    }
+
+    bool at_end() const { return pos >= tokens.size(); }
+
+    bool next_string(std::string &s)
+    {
+        if (at_end()) return error("unexpected end of statement");
+        s = tokens[pos++];
+        return true;
+    }
+
+    bool next_float(float &f)
+    {
+        if (at_end()) return error("expected a number");
+        char *end;
+        f = strtof(tokens[pos].c_str(), &end);
+        if (*end != '\0') return error("expected a number, got '" + tokens[pos] + "'");
+        ++pos;
+        return true;
+    }
+
+    bool next_vec3(Vec3 &v)
+    {
+        return next_float(v[0]) && next_float(v[1]) && next_float(v[2]);
+    }
+
+    bool next_texture(uint32_t &texture);
+
+    bool next_material(Material *&material);
+
+    bool add_object(Hitable *hitable);
+
+    Scene &world;
+    Arena &arena;
+    MaterialPool &pool;
+    Camera &cam;
+    const char *path;
+    const char *cache_dir;
+
+    // names to pool ids
+    std::map<std::string, uint32_t> textures;
+    std::map<std::string, uint32_t> materials;
+
+    struct Image
+    {
+        Image() : data(nullptr), width(0), height(0) { }
+
+        uint8_t *data;
+        int width;
+        int height;
+    };
+
+    std::map<std::string, Image> images;
+    std::map<std::string, const MipMap *> mipmaps;
+
+    std::vector<std::string> tokens;
+    size_t pos;
+    int line_no;
+};
+
+bool SceneParser::parse()
+{
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "Error: can't open scene file " << path << std::endl;
+        return false;
+    }
+
+    std::string line;
+    while (std::getline(in, line)) {
+        ++line_no;
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.resize(comment);
+        }
+
+        tokens.clear();
+        pos = 0;
+        std::istringstream ss(line);
+        std::string token;
+        while (ss >> token) {
+            tokens.push_back(token);
+        }
+        if (tokens.empty()) continue;
+
+        std::string keyword = tokens[pos++];
+        if (!statement(keyword)) {
+            return false;
+        }
+        if (!at_end()) {
+            return error("unexpected '" + tokens[pos] + "'");
+        }
+    }
+
+    return true;
+}
+
+bool SceneParser::next_texture(uint32_t &texture)
+{
+    if (at_end()) return error("expected a texture");
+
+    char *end;
+    strtof(tokens[pos].c_str(), &end);
+    if (*end == '\0') {
+        Vec3 color;
+        if (!next_vec3(color)) return false;
+        texture = pool.constant(color);
+        return true;
+    }
+
+    auto it = textures.find(tokens[pos]);
+    if (it == textures.end()) return error("unknown texture '" + tokens[pos] + "'");
+    texture = it->second;
+    ++pos;
+    return true;
+}
+
+bool SceneParser::next_material(Material *&material)
+{
+    if (at_end()) return error("expected a material");
+    auto it = materials.find(tokens[pos]);
+    if (it == materials.end()) return error("unknown material '" + tokens[pos] + "'");
+    material = pool.material(it->second);
+    ++pos;
+    return true;
+}
+
+bool SceneParser::add_object(Hitable *hitable)
+{
+    float r[3] = { 0.0, 0.0, 0.0 };
+    float t[3] = { 0.0, 0.0, 0.0 };
+    Vec3 scale(1.0);
+    bool transformed = false;
+    while (!at_end()) {
+        std::string keyword = tokens[pos++];
+        if (keyword == "rotate") {
+            if (!next_float(r[0]) || !next_float(r[1]) || !next_float(r[2])) return false;
+        } else if (keyword == "translate") {
+            if (!next_float(t[0]) || !next_float(t[1]) || !next_float(t[2])) return false;
+        } else if (keyword == "scale") {
+            // one uniform factor or one per axis
+            if (!next_float(scale[0])) return false;
+            scale[1] = scale[2] = scale[0];
+            if (!at_end() && tokens[pos] != "rotate" && tokens[pos] != "translate") {
+                if (!next_float(scale[1]) || !next_float(scale[2])) return false;
+            }
+            if (scale[0] == 0.0 || scale[1] == 0.0 || scale[2] == 0.0) return error("scale can't be zero");
+        } else {
+            return error("unknown object option '" + keyword + "'");
+        }
+        transformed = true;
+    }
+
+    if (transformed) {
+        ObjectFrame *frame = arena.make<ObjectFrame>(hitable);
+        frame->set_transform(r[0], r[1], r[2], t[0], t[1], t[2], scale);
+        hitable = frame;
+    }
+    world.add(hitable);
+    return true;
+}
+
+bool SceneParser::statement(const std::string &keyword)
+{
+    if (keyword == "camera") {
+        float fov = 20.0, aspect = 1.33333, aperture = 0.0, focus = 1.0;
+        Vec3 from(0.0), to(0.0, 0.0, -1.0), up(0.0, 1.0, 0.0);
+        bool has_focus = false;
+        while (!at_end()) {
+            std::string key = tokens[pos++];
+            bool ok;
+            if (key == "fov") ok = next_float(fov);
+            else if (key == "aspect") ok = next_float(aspect);
+            else if (key == "aperture") ok = next_float(aperture);
+            else if (key == "focus") ok = has_focus = next_float(focus);
+            else if (key == "from") ok = next_vec3(from);
+            else if (key == "to") ok = next_vec3(to);
+            else if (key == "up") ok = next_vec3(up);
+            else return error("unknown camera parameter '" + key + "'");
+            if (!ok) return false;
+        }
+        cam.setup(fov, aspect);
+        cam.look_at(from, to, up);
+        cam.set_lens(aperture, has_focus ? focus : (to - from).length());
+        return true;
+    }
+
+    if (keyword == "texture") {
+        std::string name, type;
+        if (!next_string(name) || !next_string(type)) return false;
+        uint32_t texture;
+        if (type == "constant") {
+            Vec3 color;
+            if (!next_vec3(color)) return false;
+            texture = pool.constant(color);
+        } else if (type == "checker") {
+            uint32_t t1, t2;
+            float scale = 10.0;
+            if (!next_texture(t1) || !next_texture(t2)) return false;
+            if (!at_end() && !next_float(scale)) return false;
+            texture = pool.checker(t1, t2, scale);
+        } else if (type == "noise") {
+            float scale;
+            if (!next_float(scale)) return false;
+            texture = pool.noise(scale);
+        } else if (type == "image") {
+            std::string file;
+            if (!next_string(file)) return false;
+            // a file used by several textures is loaded once, and its
+            // textures then share the same pool entry
+            if (file.size() > 6 && file.compare(file.size() - 6, 6, ".rttex") == 0) {
+                const MipMap *&mipmap = mipmaps[file];
+                if (!mipmap) {
+                    mipmap = arena.own(load_texture_file(file.c_str(), world.texture_cache()));
+                    if (!mipmap) return error("can't load texture file '" + file + "'");
+                }
+                texture = pool.image(mipmap);
+            } else {
+                Image &image = images[file];
+                if (!image.data) {
+                    int nc;
+                    image.data = stbi_load(file.c_str(), &image.width, &image.height, &nc, 3);
+                    if (!image.data) return error("can't load image '" + file + "'");
+                }
+                texture = pool.image(image.data, image.width, image.height, 3);
+            }
+        } else {
+            return error("unknown texture type '" + type + "'");
+        }
+        textures[name] = texture;
+        return true;
+    }
+
+    if (keyword == "material") {
+        std::string name, type;
+        if (!next_string(name) || !next_string(type)) return false;
+        uint32_t material;
+        if (type == "lambertian") {
+            uint32_t albedo;
+            if (!next_texture(albedo)) return false;
+            material = pool.lambertian(albedo);
+        } else if (type == "metal") {
+            uint32_t albedo;
+            float glossiness = 0.0;
+            if (!next_texture(albedo)) return false;
+            if (!at_end() && !next_float(glossiness)) return false;
+            material = pool.metal(albedo, glossiness);
+        } else if (type == "dielectric") {
+            float ior;
+            if (!next_float(ior)) return false;
+            material = pool.dielectric(ior);
+        } else if (type == "light") {
+            uint32_t emit;
+            if (!next_texture(emit)) return false;
+            material = pool.light(emit);
+        } else {
+            return error("unknown material type '" + type + "'");
+        }
+        materials[name] = material;
+        return true;
+    }
+
+    if (keyword == "sphere") {
+        Vec3 center;
+        float radius;
+        Material *material;
+        if (!next_vec3(center) || !next_float(radius) || !next_material(material)) return false;
+        return add_object(arena.make<Sphere>(center, radius, material));
+    }
+
+    if (keyword == "plane") {
+        Vec3 point, normal;
+        Material *material;
+        if (!next_vec3(point) || !next_vec3(normal) || !next_material(material)) return false;
+        world.add(arena.make<Plane>(point, normal, material));
+        return true;
+    }
+
+    if (keyword == "rectangle") {
+        float width, height;
+        Material *material;
+        if (!next_float(width) || !next_float(height) || !next_material(material)) return false;
+        return add_object(arena.make<XYRectangle>(width, height, material));
+    }
+
+    if (keyword == "mesh") {
+        std::string file;
+        Material *material;
+        if (!next_string(file) || !next_material(material)) return false;
+        TriangleMesh *mesh = nullptr;
+        if (file.size() > 7 && file.compare(file.size() - 7, 7, ".rtmesh") == 0) {
+            mesh = arena.own(load_mesh_file(file.c_str(), material, BVHSettings(), cache_dir));
+        } else {
+            MeshBuffers buffers;
+            if (load_obj(file.c_str(), buffers)) {
+                mesh = arena.make<TriangleMesh>(std::move(buffers), material, BVHSettings(), cache_dir);
+            }
+        }
+        if (!mesh) return error("can't load mesh '" + file + "'");
+        return add_object(mesh);
+    }
+
+    if (keyword == "environment") {
+        std::string type;
+        if (!next_string(type)) return false;
+        if (type == "constant") {
+            Vec3 color;
+            if (!next_vec3(color)) return false;
+            world.set_environment(arena.make<ConstantEnvironment>(color));
+        } else if (type == "gradient") {
+            Vec3 top, bottom;
+            if (!next_vec3(top) || !next_vec3(bottom)) return false;
+            world.set_environment(arena.make<GradientEnvironment>(top, bottom));
+        } else if (type == "latlong") {
+            std::string file;
+            float intensity = 1.0;
+            if (!next_string(file)) return false;
+            if (!at_end() && !next_float(intensity)) return false;
+            int width, height, nc;
+            float *data = stbi_loadf(file.c_str(), &width, &height, &nc, 3);
+            if (!data) return error("can't load image '" + file + "'");
+            world.set_environment(arena.make<LatLongEnvironment>(data, width, height, 3, intensity));
+            stbi_image_free(data);
+        } else {
+            return error("unknown environment type '" + type + "'");
+        }
+        return true;
+    }
+
+    return error("unknown statement '" + keyword + "'");
+}
+
+} // namespace
+
+bool load_scene_file(const char *path, Scene &world, Camera &cam, const char *cache_dir)
+{
+    SceneParser parser(world, cam, path, cache_dir);
+    return parser.parse();
+}
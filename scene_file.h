@@ -0,0 +1,34 @@
+#pragma once
+
+#include "scene.h"
+#include "camera.h"
+
+// Text scene description, one statement per line, '#' starts a comment.
+// Textures and materials are named and referenced by name; wherever a
+// texture is expected, three numbers make an inline constant texture.
+//
+//   camera fov 20 aspect 1.333 from -5 2 30 to 0 0 0 up 0 1 0 aperture 0.2 focus 30
+//   texture <name> constant <r g b>
+//   texture <name> checker <texture> <texture> [scale]
+//   texture <name> noise <scale>
+//   texture <name> image <path|path.rttex>
+//   material <name> lambertian <texture>
+//   material <name> metal <texture> [glossiness]
+//   material <name> dielectric <ior>
+//   material <name> light <texture>
+//   sphere <x y z> <radius> <material>
+//   plane <x y z> <nx ny nz> <material>
+//   rectangle <width> <height> <material>
+//   mesh <path.obj|path.rtmesh> <material>
+//   environment constant <r g b>
+//   environment gradient <top r g b> <bottom r g b>
+//   environment latlong <path> [intensity]
+//
+// sphere, rectangle and mesh accept trailing `scale <s>|<sx sy sz>`,
+// `rotate <rx ry rz>` (degrees) and `translate <x y z>`, applied in that
+// order as in ObjectFrame::set_transform.
+//
+// checker picks its texture by the sign of the product of the sines of the
+// scaled coordinates, which is noise on the planes x, y or z = 0; move a
+// checkered plane slightly off them.
+bool load_scene_file(const char *path, Scene &world, Camera &cam, const char *cache_dir = nullptr);
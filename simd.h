@@ -0,0 +1,293 @@
+#pragma once
+
+#include "vec3.h"
+#include "mat4.h"
+
+// SSE is part of every x86-64 target; elsewhere, or with RT_NO_SIMD, the
+// same types fall back to scalar code
+#if defined(__SSE2__) && !defined(RT_NO_SIMD)
+#define RT_SSE 1
+#include <emmintrin.h>
+#endif
+
+// Vec3 padded to 16 bytes and kept in a register. Vec3 itself stays 12
+// bytes since it is written to disk as is; convert at the boundary. The
+// fourth lane is unspecified and ignored by the horizontal operations.
+class alignas(16) Vec3A
+{
+public:
+    Vec3A() { }
+
+#ifdef RT_SSE
+    Vec3A(float t) : m(_mm_set1_ps(t)) { }
+
+    Vec3A(float x, float y, float z) : m(_mm_setr_ps(x, y, z, 0.0f)) { }
+
+    explicit Vec3A(__m128 _m) : m(_m) { }
+#else
+    Vec3A(float t) { e[0] = e[1] = e[2] = e[3] = t; }
+
+    Vec3A(float x, float y, float z) { e[0] = x; e[1] = y; e[2] = z; e[3] = 0.0f; }
+#endif
+
+    explicit Vec3A(const Vec3 &v) : Vec3A(v[0], v[1], v[2]) { }
+
+    inline float x() const { return e[0]; }
+
+    inline float y() const { return e[1]; }
+
+    inline float z() const { return e[2]; }
+
+    inline float operator[](int i) const { return e[i]; }
+
+    inline Vec3 to_vec3() const { return Vec3(e[0], e[1], e[2]); }
+
+#ifdef RT_SSE
+    union
+    {
+        __m128 m;
+        float e[4];
+    };
+#else
+    float e[4];
+#endif
+};
+
+#ifdef RT_SSE
+
+inline Vec3A operator+(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_add_ps(a.m, b.m)); }
+
+inline Vec3A operator-(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_sub_ps(a.m, b.m)); }
+
+inline Vec3A operator*(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_mul_ps(a.m, b.m)); }
+
+inline Vec3A operator/(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_div_ps(a.m, b.m)); }
+
+inline Vec3A operator-(const Vec3A &a) { return Vec3A(_mm_xor_ps(a.m, _mm_set1_ps(-0.0f))); }
+
+inline Vec3A abs(const Vec3A &a) { return Vec3A(_mm_andnot_ps(_mm_set1_ps(-0.0f), a.m)); }
+
+inline Vec3A min(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_min_ps(a.m, b.m)); }
+
+inline Vec3A max(const Vec3A &a, const Vec3A &b) { return Vec3A(_mm_max_ps(a.m, b.m)); }
+
+// lane i of v copied to all four
+template<int i>
+inline Vec3A broadcast(const Vec3A &v) { return Vec3A(_mm_shuffle_ps(v.m, v.m, _MM_SHUFFLE(i, i, i, i))); }
+
+inline float dot(const Vec3A &a, const Vec3A &b)
+{
+    __m128 p = _mm_mul_ps(a.m, b.m);
+    __m128 y = _mm_shuffle_ps(p, p, _MM_SHUFFLE(1, 1, 1, 1));
+    __m128 z = _mm_shuffle_ps(p, p, _MM_SHUFFLE(2, 2, 2, 2));
+    return _mm_cvtss_f32(_mm_add_ss(_mm_add_ss(p, y), z));
+}
+
+inline Vec3A cross(const Vec3A &a, const Vec3A &b)
+{
+    __m128 a_yzx = _mm_shuffle_ps(a.m, a.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 b_yzx = _mm_shuffle_ps(b.m, b.m, _MM_SHUFFLE(3, 0, 2, 1));
+    __m128 c = _mm_sub_ps(_mm_mul_ps(a.m, b_yzx), _mm_mul_ps(a_yzx, b.m));
+    return Vec3A(_mm_shuffle_ps(c, c, _MM_SHUFFLE(3, 0, 2, 1)));
+}
+
+#else
+
+inline Vec3A operator+(const Vec3A &a, const Vec3A &b) { return Vec3A(a.e[0] + b.e[0], a.e[1] + b.e[1], a.e[2] + b.e[2]); }
+
+inline Vec3A operator-(const Vec3A &a, const Vec3A &b) { return Vec3A(a.e[0] - b.e[0], a.e[1] - b.e[1], a.e[2] - b.e[2]); }
+
+inline Vec3A operator*(const Vec3A &a, const Vec3A &b) { return Vec3A(a.e[0] * b.e[0], a.e[1] * b.e[1], a.e[2] * b.e[2]); }
+
+inline Vec3A operator/(const Vec3A &a, const Vec3A &b) { return Vec3A(a.e[0] / b.e[0], a.e[1] / b.e[1], a.e[2] / b.e[2]); }
+
+inline Vec3A operator-(const Vec3A &a) { return Vec3A(-a.e[0], -a.e[1], -a.e[2]); }
+
+inline Vec3A abs(const Vec3A &a) { return Vec3A(fabs(a.e[0]), fabs(a.e[1]), fabs(a.e[2])); }
+
+inline Vec3A min(const Vec3A &a, const Vec3A &b) { return Vec3A(fmin(a.e[0], b.e[0]), fmin(a.e[1], b.e[1]), fmin(a.e[2], b.e[2])); }
+
+inline Vec3A max(const Vec3A &a, const Vec3A &b) { return Vec3A(fmax(a.e[0], b.e[0]), fmax(a.e[1], b.e[1]), fmax(a.e[2], b.e[2])); }
+
+template<int i>
+inline Vec3A broadcast(const Vec3A &v) { return Vec3A(v.e[i]); }
+
+inline float dot(const Vec3A &a, const Vec3A &b)
+{
+    return a.e[0] * b.e[0] + a.e[1] * b.e[1] + a.e[2] * b.e[2];
+}
+
+inline Vec3A cross(const Vec3A &a, const Vec3A &b)
+{
+    return Vec3A(a.e[1] * b.e[2] - a.e[2] * b.e[1],
+                 a.e[2] * b.e[0] - a.e[0] * b.e[2],
+                 a.e[0] * b.e[1] - a.e[1] * b.e[0]);
+}
+
+#endif
+
+inline Vec3A operator*(float t, const Vec3A &v) { return Vec3A(t) * v; }
+
+inline Vec3A operator*(const Vec3A &v, float t) { return v * Vec3A(t); }
+
+inline Vec3A operator/(const Vec3A &v, float t) { return v * Vec3A(1.0f / t); }
+
+inline float length(const Vec3A &v) { return sqrt(dot(v, v)); }
+
+inline Vec3A unit_vector(const Vec3A &v) { return v / length(v); }
+
+// Four independent floats, e.g. one coordinate of four rays of a packet.
+// Comparisons return a bit mask with bit i set for lane i.
+class alignas(16) Float4
+{
+public:
+    Float4() { }
+
+#ifdef RT_SSE
+    Float4(float t) : m(_mm_set1_ps(t)) { }
+
+    explicit Float4(__m128 _m) : m(_m) { }
+
+    // p must be 16 byte aligned
+    static Float4 load(const float *p) { return Float4(_mm_load_ps(p)); }
+
+    union
+    {
+        __m128 m;
+        float e[4];
+    };
+#else
+    Float4(float t) { e[0] = e[1] = e[2] = e[3] = t; }
+
+    static Float4 load(const float *p)
+    {
+        Float4 r;
+        r.e[0] = p[0]; r.e[1] = p[1]; r.e[2] = p[2]; r.e[3] = p[3];
+        return r;
+    }
+
+    float e[4];
+#endif
+};
+
+#ifdef RT_SSE
+
+inline Float4 operator+(const Float4 &a, const Float4 &b) { return Float4(_mm_add_ps(a.m, b.m)); }
+
+inline Float4 operator-(const Float4 &a, const Float4 &b) { return Float4(_mm_sub_ps(a.m, b.m)); }
+
+inline Float4 operator*(const Float4 &a, const Float4 &b) { return Float4(_mm_mul_ps(a.m, b.m)); }
+
+// like the scalar `a < b ? a : b`, b is returned when a lane is NaN
+inline Float4 min(const Float4 &a, const Float4 &b) { return Float4(_mm_min_ps(a.m, b.m)); }
+
+inline Float4 max(const Float4 &a, const Float4 &b) { return Float4(_mm_max_ps(a.m, b.m)); }
+
+inline int less_equal_mask(const Float4 &a, const Float4 &b) { return _mm_movemask_ps(_mm_cmple_ps(a.m, b.m)); }
+
+#else
+
+inline Float4 operator+(const Float4 &a, const Float4 &b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i) r.e[i] = a.e[i] + b.e[i];
+    return r;
+}
+
+inline Float4 operator-(const Float4 &a, const Float4 &b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i) r.e[i] = a.e[i] - b.e[i];
+    return r;
+}
+
+inline Float4 operator*(const Float4 &a, const Float4 &b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i) r.e[i] = a.e[i] * b.e[i];
+    return r;
+}
+
+inline Float4 min(const Float4 &a, const Float4 &b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i) r.e[i] = a.e[i] < b.e[i] ? a.e[i] : b.e[i];
+    return r;
+}
+
+inline Float4 max(const Float4 &a, const Float4 &b)
+{
+    Float4 r;
+    for (int i = 0; i < 4; ++i) r.e[i] = a.e[i] > b.e[i] ? a.e[i] : b.e[i];
+    return r;
+}
+
+inline int less_equal_mask(const Float4 &a, const Float4 &b)
+{
+    int mask = 0;
+    for (int i = 0; i < 4; ++i) mask |= (a.e[i] <= b.e[i]) << i;
+    return mask;
+}
+
+#endif
+
+// 3x4 affine transform y = L x + t, stored by columns so that a point is
+// transformed with three broadcasts and multiply-adds
+class Affine3
+{
+public:
+    Affine3() : Affine3(Vec3A(1.0f, 0.0f, 0.0f), Vec3A(0.0f, 1.0f, 0.0f), Vec3A(0.0f, 0.0f, 1.0f), Vec3A(0.0f)) { }
+
+    Affine3(const Vec3A &c0, const Vec3A &c1, const Vec3A &c2, const Vec3A &t)
+    {
+        cols[0] = c0;
+        cols[1] = c1;
+        cols[2] = c2;
+        cols[3] = t;
+    }
+
+    // the upper 3x4 block, the last row is assumed to be (0, 0, 0, 1)
+    explicit Affine3(const Mat4 &M)
+    : Affine3(Vec3A(M[0][0], M[1][0], M[2][0]), Vec3A(M[0][1], M[1][1], M[2][1]),
+              Vec3A(M[0][2], M[1][2], M[2][2]), Vec3A(M[0][3], M[1][3], M[2][3])) { }
+
+    inline Vec3A transform_vector(const Vec3A &v) const
+    {
+        return cols[0] * broadcast<0>(v) + cols[1] * broadcast<1>(v) + cols[2] * broadcast<2>(v);
+    }
+
+    inline Vec3A transform_point(const Vec3A &p) const
+    {
+        return transform_vector(p) + cols[3];
+    }
+
+    // applies the transpose of the linear part, which is its inverse for
+    // rotations and the normal matrix of the inverse transform
+    inline Vec3A transpose_transform_vector(const Vec3A &v) const
+    {
+        return Vec3A(dot(cols[0], v), dot(cols[1], v), dot(cols[2], v));
+    }
+
+    // the rows of the inverse linear part are cross products of the
+    // columns; the transform must not be singular
+    Affine3 inverse() const
+    {
+        Vec3A r0 = cross(cols[1], cols[2]);
+        Vec3A r1 = cross(cols[2], cols[0]);
+        Vec3A r2 = cross(cols[0], cols[1]);
+        float inv_det = 1.0f / dot(cols[0], r0);
+        r0 = r0 * inv_det;
+        r1 = r1 * inv_det;
+        r2 = r2 * inv_det;
+
+        Affine3 inv(Vec3A(r0.x(), r1.x(), r2.x()), Vec3A(r0.y(), r1.y(), r2.y()),
+                    Vec3A(r0.z(), r1.z(), r2.z()), Vec3A(0.0f));
+        inv.cols[3] = -inv.transform_vector(cols[3]);
+        return inv;
+    }
+
+    const Vec3A &column(int i) const { return cols[i]; }
+
+private:
+    Vec3A cols[4];
+};
@@ -1,11 +1,10 @@
 #pragma once
 
 #include "hitable.h"
+#include "material.h"
 
 #include <iostream>
 
-class Material;
-
 
 class Sphere : public Hitable
 {
@@ -28,6 +27,15 @@ public:
         v = (theta + M_PI/2.0) / M_PI;
     }
 
+    // derivatives of the point at unit vector q from the center, for the
+    // mapping of get_uv; dpdu vanishes at the poles
+    inline void get_dpduv(const Vec3 &q, Vec3 &dpdu, Vec3 &dpdv) const
+    {
+        float cos_theta = std::max(sqrtf(q.x() * q.x() + q.z() * q.z()), 1e-4f);
+        dpdu = float(-2.0 * M_PI) * radius * Vec3(-q.z(), 0.0f, q.x());
+        dpdv = float(M_PI) * radius * Vec3(-q.y() * q.x() / cos_theta, cos_theta, -q.y() * q.z() / cos_theta);
+    }
+
     friend std::ostream& operator<<(std::ostream &os, Sphere &s)
     {
         os << s.center << ", r = " << s.radius;
@@ -42,7 +50,7 @@ private:
 };
 
 
-bool Sphere::hit(const Ray &ray, float tmin, float tmax, Hit &hit) const
+inline bool Sphere::hit(const Ray &ray, float tmin, float tmax, Hit &hit) const
 {
     Vec3 oc = ray.origin() - center;
     float a = dot(ray.direction(), ray.direction());
@@ -52,30 +60,33 @@ bool Sphere::hit(const Ray &ray, float tmin, float tmax, Hit &hit) const
     float dis = b * b - a * c;
     if (dis > 0.0) {
         float t = (-b - sqrt(dis)) / a;
-        if (t > tmin && t < tmax) {
-            hit.p = ray.point_at_parameter(t);
-            hit.normal = (ray.point_at_parameter(t) - center) / radius;
-            hit.t = t;
-            hit.material = material;
-            get_uv(hit.p, hit.u, hit.v);
-            return true;
+        if (!(t > tmin && t < tmax)) {
+            t = (-b + sqrt(dis)) / a;
+            if (!(t > tmin && t < tmax)) {
+                return false;
+            }
         }
 
-        t = (-b + sqrt(dis)) / a;
-        if (t > tmin && t < tmax) {
-            hit.p = ray.point_at_parameter(t);
-            hit.normal = (ray.point_at_parameter(t) - center) / radius;
-            hit.t = t;
-            hit.material = material;
+        hit.p = ray.point_at_parameter(t);
+        hit.normal = (hit.p - center) / radius;
+        hit.t = t;
+        hit.material = material;
+        // the inverse trigonometry is only paid for textures that use it
+        if (material->needs_uv()) {
             get_uv(hit.p, hit.u, hit.v);
-            return true;
+            get_dpduv(hit.normal, hit.dpdu, hit.dpdv);
+        } else {
+            hit.u = hit.v = 0.0f;
+            hit.dpdu = hit.dpdv = Vec3(0.0f);
         }
+        hit.curvature = 1.0f / radius;
+        return true;
     }   
 
     return false;
 }
 
-bool Sphere::bounding_box(AABB &box) const
+inline bool Sphere::bounding_box(AABB &box) const
 {
     box = AABB(center - radius, center + radius);
     
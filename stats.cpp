@@ -0,0 +1,161 @@
+#include "stats.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace {
+
+const char *ray_type_names[RenderStats::N_RAY_TYPES] = { "camera", "bounce", "shadow" };
+
+const char *material_kind_names[RenderStats::n_material_kinds] = { "lambertian", "metal", "dielectric", "light" };
+
+// highest non empty bucket of the path length histogram
+int last_path_length(const RenderStats &stats)
+{
+    int last = 0;
+    for (int i = 0; i < RenderStats::n_path_lengths; ++i) {
+        if (stats.path_lengths[i] > 0) {
+            last = i;
+        }
+    }
+    return last;
+}
+
+} // namespace
+
+void RenderStats::clear()
+{
+    std::fill(rays, rays + N_RAY_TYPES, 0);
+    nodes_visited = 0;
+    primitive_tests = 0;
+    std::fill(shading_calls, shading_calls + n_material_kinds, 0);
+    misses = 0;
+    std::fill(path_lengths, path_lengths + n_path_lengths, 0);
+    samples = 0;
+    pixels = 0;
+}
+
+void RenderStats::add(const RenderStats &other)
+{
+    for (int i = 0; i < N_RAY_TYPES; ++i) {
+        rays[i] += other.rays[i];
+    }
+    nodes_visited += other.nodes_visited;
+    primitive_tests += other.primitive_tests;
+    for (int i = 0; i < n_material_kinds; ++i) {
+        shading_calls[i] += other.shading_calls[i];
+    }
+    misses += other.misses;
+    for (int i = 0; i < n_path_lengths; ++i) {
+        path_lengths[i] += other.path_lengths[i];
+    }
+    samples += other.samples;
+    pixels += other.pixels;
+}
+
+void RenderStats::print(std::ostream &out) const
+{
+    uint64_t total_rays = 0;
+    for (int i = 0; i < N_RAY_TYPES; ++i) {
+        total_rays += rays[i];
+    }
+    double per_ray = total_rays ? 1.0 / total_rays : 0.0;
+
+    out << std::fixed << std::setprecision(2);
+    out << "rays: " << total_rays;
+    for (int i = 0; i < N_RAY_TYPES; ++i) {
+        out << (i ? ", " : " (") << ray_type_names[i] << " " << rays[i];
+    }
+    out << ")\n"
+        << "BVH nodes: " << nodes_visited << " (" << nodes_visited * per_ray << " per ray)\n"
+        << "primitive tests: " << primitive_tests << " (" << primitive_tests * per_ray << " per ray)\n"
+        << "shading calls:";
+    for (int i = 0; i < n_material_kinds; ++i) {
+        out << " " << material_kind_names[i] << " " << shading_calls[i];
+    }
+    out << ", misses " << misses << "\n"
+        << "path lengths:";
+    for (int i = 0; i <= last_path_length(*this); ++i) {
+        out << " " << path_lengths[i];
+    }
+    out << "\n"
+        << "samples: " << samples << " (" << (pixels ? double(samples) / pixels : 0.0) << " per pixel)"
+        << std::endl;
+}
+
+void RenderStats::write_json(std::ostream &out, int indent) const
+{
+    std::string pad(indent, ' ');
+    out << "{\n" << pad << "  \"rays\": {";
+    for (int i = 0; i < N_RAY_TYPES; ++i) {
+        out << (i ? ", " : " ") << "\"" << ray_type_names[i] << "\": " << rays[i];
+    }
+    out << " },\n"
+        << pad << "  \"nodes_visited\": " << nodes_visited << ",\n"
+        << pad << "  \"primitive_tests\": " << primitive_tests << ",\n"
+        << pad << "  \"shading_calls\": {";
+    for (int i = 0; i < n_material_kinds; ++i) {
+        out << (i ? ", " : " ") << "\"" << material_kind_names[i] << "\": " << shading_calls[i];
+    }
+    out << " },\n"
+        << pad << "  \"misses\": " << misses << ",\n"
+        << pad << "  \"path_lengths\": [";
+    for (int i = 0; i <= last_path_length(*this); ++i) {
+        out << (i ? ", " : " ") << path_lengths[i];
+    }
+    out << " ],\n"
+        << pad << "  \"samples\": " << samples << ",\n"
+        << pad << "  \"pixels\": " << pixels << "\n"
+        << pad << "}";
+}
+
+#ifdef RT_STATS
+
+namespace {
+
+std::mutex registry_mutex;
+std::vector<ThreadStats *> registry;
+// what the threads that exited counted
+RenderStats retired;
+
+} // namespace
+
+ThreadStats::ThreadStats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(this);
+}
+
+ThreadStats::~ThreadStats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    retired.add(*this);
+    registry.erase(std::find(registry.begin(), registry.end(), this));
+}
+
+thread_local ThreadStats thread_stats;
+
+RenderStats collect_stats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    RenderStats sum = retired;
+    for (const ThreadStats *stats : registry) {
+        sum.add(*stats);
+    }
+    return sum;
+}
+
+void reset_stats()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    retired.clear();
+    for (ThreadStats *stats : registry) {
+        stats->clear();
+    }
+}
+
+#endif
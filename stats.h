@@ -0,0 +1,81 @@
+#pragma once
+
+#include <stdint.h>
+#include <iosfwd>
+
+// Render counters. With RT_STATS (meson -Dstats=true) every thread counts
+// into its own RenderStats through the STAT_* macros, and collect_stats()
+// sums them between frames. Without it the macros expand to nothing and
+// the release build pays nothing.
+struct RenderStats
+{
+    enum RayType { CAMERA_RAY, BOUNCE_RAY, SHADOW_RAY, N_RAY_TYPES };
+
+    // one per Material::Kind, checked in integrator.cpp
+    static const int n_material_kinds = 4;
+
+    // paths of this many bounces or more share the last bucket
+    static const int n_path_lengths = 16;
+
+    RenderStats() { clear(); }
+
+    void clear();
+
+    void add(const RenderStats &other);
+
+    // human readable summary
+    void print(std::ostream &out) const;
+
+    // a JSON object, the lines after the first one indented by `indent`
+    void write_json(std::ostream &out, int indent = 0) const;
+
+    uint64_t rays[N_RAY_TYPES];
+    uint64_t nodes_visited;
+    uint64_t primitive_tests;
+    uint64_t shading_calls[n_material_kinds];
+    // rays that left the scene
+    uint64_t misses;
+    uint64_t path_lengths[n_path_lengths];
+    uint64_t samples;
+    uint64_t pixels;
+};
+
+#ifdef RT_STATS
+
+// registers itself so that collect_stats() finds it; what a thread counted
+// is kept when it exits
+struct ThreadStats : public RenderStats
+{
+    ThreadStats();
+
+    ~ThreadStats();
+};
+
+// counters of the calling thread
+extern thread_local ThreadStats thread_stats;
+
+// sum over all the threads, call it outside of parallel regions
+RenderStats collect_stats();
+
+void reset_stats();
+
+#define STAT_ADD(counter, n) (thread_stats.counter += (n))
+#define STAT_INC(counter) (thread_stats.counter++)
+
+// thread_stats has a constructor, so every access to it from another file
+// goes through its initialization check; loops bind the counters of their
+// thread once to a local reference and count through it
+#define STAT_BIND(stats) RenderStats &stats = thread_stats
+#define STAT_ADD_TO(stats, counter, n) ((stats).counter += (n))
+#define STAT_INC_TO(stats, counter) ((stats).counter++)
+
+#else
+
+#define STAT_ADD(counter, n) ((void)0)
+#define STAT_INC(counter) ((void)0)
+
+#define STAT_BIND(stats) ((void)0)
+#define STAT_ADD_TO(stats, counter, n) ((void)0)
+#define STAT_INC_TO(stats, counter) ((void)0)
+
+#endif
@@ -0,0 +1,180 @@
+#include "bvh.h"
+#include "wide_bvh.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// BVH caches and mesh files are mapped and traversed in place, so damaged
+// trees must be rejected when loaded: shared subtrees, trees deeper than
+// the traversal stacks, truncated files. Packets must find the same hits
+// as single rays in both the binary and the quantized trees.
+
+namespace {
+
+const char *cache_file = "test_bvh.bvh";
+// the nodes follow a 64-byte header, `offset` sits after bmin
+const size_t nodes_offset = 64;
+const size_t node_offset_field = 12;
+
+// a chain of `depth` interior nodes, each with a leaf as second child; the
+// deepest leaf is at `depth`
+std::vector<BVHFlatNode> chain(int depth)
+{
+    std::vector<BVHFlatNode> nodes(2 * depth + 1);
+    for (int i = 0; i < int(nodes.size()); ++i) {
+        BVHFlatNode &node = nodes[i];
+        node.bmin = Vec3(-1.0);
+        node.bmax = Vec3(1.0);
+        node.axis = 0;
+        if (i < depth) {
+            node.offset = depth + 1 + i;
+            node.count = 0;
+        } else {
+            node.offset = 0;
+            node.count = 1;
+        }
+    }
+    return nodes;
+}
+
+// the ball inscribed in `box`
+bool hit_ball(const AABB &box, const Ray &ray, float tmin, float tmax, Hit &hit)
+{
+    Vec3 center = 0.5f * (box.min() + box.max());
+    float radius = 0.5f * (box.max().x() - box.min().x());
+    Vec3 oc = ray.origin() - center;
+    float b = dot(oc, ray.direction());
+    float c = dot(oc, oc) - radius * radius;
+    float disc = b * b - c;
+    if (disc < 0.0f) {
+        return false;
+    }
+    float t = -b - sqrtf(disc);
+    if (t <= tmin || t >= tmax) {
+        return false;
+    }
+    hit.t = t;
+    return true;
+}
+
+// traces packets of unit rays from a corner of the boxes across them with
+// hit_packet and ray by ray with hit, true when the hits agree; the any-hit
+// queries, for single rays and packets, must find the rays that hit short
+// of `shadow_tmax` blocked
+template<typename Tree>
+bool packets_match(const Tree &tree, const std::vector<AABB> &boxes)
+{
+    auto leaf_hit = [&](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+        return hit_ball(boxes[tree.primitive(i)], r, t0, t1, h);
+    };
+    auto leaf_occluded = [&](uint32_t i, const Ray &r, float t0, float t1) {
+        Hit h;
+        return hit_ball(boxes[tree.primitive(i)], r, t0, t1, h);
+    };
+    const float shadow_tmax = 8.0f;
+
+    uint32_t state = 1;
+    auto next = [&]() {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (1.0f / 16777216.0f);
+    };
+
+    for (int p = 0; p < 1000; ++p) {
+        Ray rays[RayPacket::size];
+        Vec3 origin(-2.0f - next(), -2.0f - next(), -2.0f - next());
+        for (Ray &r : rays) {
+            Vec3 target(10.0f * next(), 10.0f * next(), 10.0f * next());
+            r = Ray(origin, unit_vector(target - origin));
+        }
+        int n = 1 + p % RayPacket::size;
+        RayPacket packet(rays, n, 100.0f);
+        Hit hits[RayPacket::size];
+        uint32_t found = tree.hit_packet(packet, 0.0f, hits, leaf_hit);
+        RayPacket shadows(rays, n, shadow_tmax);
+        uint32_t blocked = tree.occluded_packet(shadows, 0.0f, leaf_occluded);
+
+        for (int k = 0; k < n; ++k) {
+            Hit hit;
+            bool single = tree.hit(rays[k], 0.0f, 100.0f, hit, leaf_hit);
+            if (single != bool(found >> k & 1) || (single && hit.t != hits[k].t)) {
+                return false;
+            }
+            bool short_hit = single && hit.t < shadow_tmax;
+            if (short_hit != tree.occluded(rays[k], 0.0f, shadow_tmax, leaf_occluded)
+                || short_hit != bool(blocked >> k & 1)) {
+                return false;
+            }
+        }
+        if (found >> n || blocked >> n) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+
+    std::vector<AABB> boxes;
+    for (int i = 0; i < 1000; ++i) {
+        Vec3 p(i % 10, (i / 10) % 10, i / 100);
+        boxes.push_back(AABB(p, p + Vec3(0.5)));
+    }
+    BVHSettings settings;
+    uint64_t hash = bvh_hash(boxes, settings);
+
+    BVHTree tree;
+    tree.build(boxes, settings);
+    ok &= check(tree.node_count() > 3 && tree.node_data()[1].count == 0, "build");
+    ok &= check(tree.save(cache_file, hash), "save");
+
+    BVHTree loaded;
+    ok &= check(loaded.load(cache_file, hash, boxes.size()), "load");
+    ok &= check(!loaded.load(cache_file, hash + 1, boxes.size()), "reject another hash");
+
+    ok &= check(packets_match(tree, boxes), "binary tree packets and occlusion match single rays");
+    WideBVH wide;
+    wide.build(tree);
+    ok &= check(packets_match(wide, boxes), "quantized tree packets and occlusion match single rays");
+
+    std::vector<char> bytes = read_file(cache_file);
+
+    write_file(cache_file, bytes, bytes.size() / 2);
+    ok &= check(!loaded.load(cache_file, hash, boxes.size()), "reject a truncated file");
+
+    // the root's second child becomes the first child of its first child,
+    // which is then reached twice
+    std::vector<char> shared = bytes;
+    uint32_t offset = 2;
+    memcpy(&shared[nodes_offset + node_offset_field], &offset, sizeof(offset));
+    write_file(cache_file, shared, shared.size());
+    ok &= check(!loaded.load(cache_file, hash, boxes.size()), "reject a shared subtree");
+    remove(cache_file);
+
+    uint32_t index = 0;
+    std::vector<BVHFlatNode> nodes = chain(BVHTree::max_depth - 1);
+    ok &= check(loaded.attach(nodes.data(), nodes.size(), &index, 1, 1), "attach a tree of the largest depth");
+    Hit hit;
+    Ray ray(Vec3(0.0, 0.0, -5.0), Vec3(0.0, 0.0, 1.0));
+    int leaves = 0;
+    loaded.hit(ray, 0.0f, 100.0f, hit, [&](uint32_t, const Ray &, float, float, Hit &) { ++leaves; return false; });
+    ok &= check(leaves == BVHTree::max_depth, "traverse it");
+
+    nodes = chain(BVHTree::max_depth);
+    ok &= check(!loaded.attach(nodes.data(), nodes.size(), &index, 1, 1), "reject a deeper tree");
+
+    // coincident boxes only allow median splits, the builder stays within
+    // the depth limit anyway
+    std::vector<AABB> stacked(100000, AABB(Vec3(0.0), Vec3(1.0)));
+    BVHSettings single;
+    single.max_leaf_size = 1;
+    tree.build(stacked, single);
+    ok &= check(loaded.attach(tree.node_data(), tree.node_count(), tree.index_data(), tree.index_count(),
+                              stacked.size()), "build within the depth limit");
+
+    return ok ? 0 : 1;
+}
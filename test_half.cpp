@@ -0,0 +1,106 @@
+#include "half.h"
+#include "test_util.h"
+
+#include <math.h>
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#endif
+
+// float_to_half and half_to_float: exact round trips, rounding to nearest
+// even between neighbouring halves, overflow and subnormals, and on x86
+// CPUs with F16C the same results as the hardware conversions
+
+namespace {
+
+bool is_nan_half(uint16_t h)
+{
+    return (h & 0x7c00) == 0x7c00 && (h & 0x3ff) != 0;
+}
+
+float from_bits(uint32_t x)
+{
+    float f;
+    memcpy(&f, &x, sizeof(f));
+    return f;
+}
+
+#if defined(__GNUC__) && defined(__x86_64__)
+__attribute__((target("f16c"))) uint16_t hardware_to_half(float f)
+{
+    return _cvtss_sh(f, _MM_FROUND_TO_NEAREST_INT);
+}
+
+__attribute__((target("f16c"))) float hardware_to_float(uint16_t h)
+{
+    return _cvtsh_ss(h);
+}
+
+// every half, and one float in 251 over all the bit patterns
+bool matches_hardware()
+{
+    for (uint32_t h = 0; h < 65536; ++h) {
+        float a = half_to_float(h);
+        float b = hardware_to_float(h);
+        if (memcmp(&a, &b, sizeof(a)) != 0 && !(isnan(a) && isnan(b))) {
+            return false;
+        }
+    }
+    for (uint64_t x = 0; x < (uint64_t(1) << 32); x += 251) {
+        float f = from_bits(uint32_t(x));
+        if (!isnan(f) && float_to_half(f) != hardware_to_half(f)) {
+            return false;
+        }
+    }
+    return true;
+}
+#endif
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+
+    bool exact = true;
+    for (uint32_t h = 0; h < 65536; ++h) {
+        if (!is_nan_half(h) && float_to_half(half_to_float(h)) != h) {
+            exact = false;
+        }
+    }
+    ok &= check(exact, "every half survives a round trip");
+
+    // between two neighbouring positive halves, the midpoint goes to the
+    // even one and anything past it to the nearest
+    bool nearest_even = true;
+    for (uint32_t h = 0; h < 0x7bff; ++h) {
+        float lo = half_to_float(h);
+        float hi = half_to_float(h + 1);
+        float mid = 0.5f * (lo + hi);
+        uint16_t even = (h & 1) ? h + 1 : h;
+        if (float_to_half(mid) != even
+            || float_to_half(nextafterf(mid, lo)) != h
+            || float_to_half(nextafterf(mid, hi)) != h + 1
+            || float_to_half(-mid) != (even | 0x8000)) {
+            nearest_even = false;
+        }
+    }
+    ok &= check(nearest_even, "rounding to nearest even");
+
+    ok &= check(float_to_half(65504.0f) == 0x7bff && float_to_half(65519.99f) == 0x7bff
+                && float_to_half(65520.0f) == 0x7c00 && float_to_half(1e10f) == 0x7c00
+                && float_to_half(-INFINITY) == 0xfc00 && is_nan_half(float_to_half(NAN)),
+                "overflow to infinity");
+    ok &= check(float_to_half(from_bits(0x33800000)) == 0x0001 && float_to_half(from_bits(0x33000000)) == 0
+                && float_to_half(from_bits(0x33000001)) == 0x0001 && half_to_float(0x0001) == from_bits(0x33800000)
+                && float_to_half(6.097555e-5f) == 0x03ff && float_to_half(6.1035156e-5f) == 0x0400,
+                "subnormals");
+
+#if defined(__GNUC__) && defined(__x86_64__)
+    if (__builtin_cpu_supports("f16c")) {
+        ok &= check(matches_hardware(), "same results as F16C");
+    }
+#endif
+
+    return ok ? 0 : 1;
+}
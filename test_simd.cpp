@@ -0,0 +1,126 @@
+#include "simd.h"
+#include "test_util.h"
+
+#include <iostream>
+#include <math.h>
+#include <stdint.h>
+
+// Vec3A and Affine3 against the plain Vec3 and Mat4 code: dot and cross
+// products, points and vectors through a transform, and inverse transforms.
+// meson builds it twice, with SSE and with RT_NO_SIMD, so that both paths
+// are held to the same reference.
+
+namespace {
+
+// deterministic values in [-1, 1)
+struct Random
+{
+    uint32_t state = 12345;
+
+    float next()
+    {
+        state = state * 1664525u + 1013904223u;
+        return (state >> 8) * (2.0f / 16777216.0f) - 1.0f;
+    }
+
+    Vec3 vec3() { float x = next(), y = next(); return Vec3(x, y, next()); }
+};
+
+bool close(float a, float b, float scale)
+{
+    return fabsf(a - b) <= 1e-5f * scale;
+}
+
+bool close(const Vec3A &a, const Vec3 &b, float scale)
+{
+    return close(a.x(), b.x(), scale) && close(a.y(), b.y(), scale) && close(a.z(), b.z(), scale);
+}
+
+Vec3A aligned(const Vec3 &v)
+{
+    return Vec3A(v.x(), v.y(), v.z());
+}
+
+// rotation about a random axis, scaled and translated; `rigid` leaves
+// out the scale, which Mat4's inverse helpers assume
+Mat4 random_transform(Random &random, bool rigid)
+{
+    Vec3 axis = unit_vector(random.vec3());
+    float angle = 3.14159265f * random.next();
+    float c = cosf(angle);
+    float s = sinf(angle);
+    Vec3 scale = rigid ? Vec3(1.0f) : Vec3(1.5f + random.next(), 1.5f + random.next(), 1.5f + random.next());
+    Vec3 t = 10.0f * random.vec3();
+
+    Mat4 M;
+    M.setIdentity();
+    for (int i = 0; i < 3; ++i) {
+        for (int j = 0; j < 3; ++j) {
+            float r = (i == j ? c : 0.0f) + (1.0f - c) * axis[i] * axis[j];
+            if (i != j) {
+                int k = 3 - i - j;
+                float sign = ((j - i + 3) % 3 == 1) ? -1.0f : 1.0f;
+                r += sign * s * axis[k];
+            }
+            M[i][j] = r * scale[j];
+        }
+        M[i][3] = t[i];
+    }
+    return M;
+}
+
+}
+
+int main(int argc, char *argv[])
+{
+#ifdef RT_SSE
+    std::cout << "SSE build" << std::endl;
+#else
+    std::cout << "scalar build" << std::endl;
+#endif
+
+    const int n = 1000;
+    Random random;
+    bool ok = true;
+
+    bool dots = true;
+    bool crosses = true;
+    for (int i = 0; i < n; ++i) {
+        Vec3 a = random.vec3();
+        Vec3 b = random.vec3();
+        dots = dots && close(dot(aligned(a), aligned(b)), dot(a, b), 1.0f);
+        crosses = crosses && close(cross(aligned(a), aligned(b)), cross(a, b), 1.0f);
+    }
+    ok &= check(dots, "dot matches Vec3");
+    ok &= check(crosses, "cross matches Vec3");
+
+    bool points = true;
+    bool vectors = true;
+    bool rigid_inverse = true;
+    bool inverse = true;
+    for (int i = 0; i < n; ++i) {
+        bool rigid = i % 2 == 0;
+        Mat4 M = random_transform(random, rigid);
+        Affine3 A(M);
+        Affine3 inv = A.inverse();
+        Vec3 p = 10.0f * random.vec3();
+        Vec3 v = random.vec3();
+
+        Vec3A q = A.transform_point(aligned(p));
+        points = points && close(q, apply_transform_point(M, p), 100.0f);
+        vectors = vectors && close(A.transform_vector(aligned(v)), apply_transform_vec(M, v), 10.0f);
+
+        if (rigid) {
+            rigid_inverse = rigid_inverse && close(inv.transform_point(aligned(p)), apply_inv_transform_point(M, p), 100.0f);
+            rigid_inverse = rigid_inverse && close(inv.transform_vector(aligned(v)), apply_inv_transform_vec(M, v), 10.0f);
+        }
+        inverse = inverse && close(inv.transform_point(q), p, 100.0f);
+        inverse = inverse && close(inv.transform_vector(A.transform_vector(aligned(v))), v, 10.0f);
+    }
+    ok &= check(points, "transform_point matches Mat4");
+    ok &= check(vectors, "transform_vector matches Mat4");
+    ok &= check(rigid_inverse, "inverse of rotations and translations matches Mat4");
+    ok &= check(inverse, "inverse undoes scaled transforms");
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,112 @@
+#include "texture_file.h"
+#include "test_util.h"
+
+#include <stdio.h>
+#include <string.h>
+
+// Texture files: the tiles written by write_texture_file come back bit for
+// bit, mapped or paged through a cache small enough to evict, so lookups
+// match the in-memory pyramid; damaged headers are rejected
+
+namespace {
+
+const char *texture_file = "test_texture.rttex";
+// header fields
+const size_t width_field = 16;
+const size_t tile_count_field = 32;
+
+bool same_tiles(const MipMap &a, const MipMap &b)
+{
+    if (a.tile_count() != b.tile_count() || a.tile_bytes() != b.tile_bytes()) {
+        return false;
+    }
+    for (uint32_t i = 0; i < a.tile_count(); ++i) {
+        if (memcmp(a.tile(i), b.tile(i), a.tile_bytes()) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool same_lookups(const MipMap &a, const MipMap &b)
+{
+    for (float u = -0.5f; u < 1.5f; u += 0.0137f) {
+        for (float v = 0.0f; v < 1.0f; v += 0.0193f) {
+            for (float footprint = 1e-4f; footprint < 1.0f; footprint *= 2.0f) {
+                Vec3 d = a.filtered(u, v, footprint) - b.filtered(u, v, footprint);
+                if (d.x() != 0.0f || d.y() != 0.0f || d.z() != 0.0f) {
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
+
+// writes `mipmap`, then reads it back mapped and paged
+bool round_trip(const MipMap &mipmap)
+{
+    bool ok = write_texture_file(texture_file, mipmap);
+
+    MipMap *mapped = load_texture_file(texture_file);
+    ok = ok && mapped && same_tiles(mipmap, *mapped) && same_lookups(mipmap, *mapped);
+    delete mapped;
+
+    // room for a few tiles only
+    TextureCache cache(4 * mipmap.tile_bytes());
+    MipMap *paged = load_texture_file(texture_file, &cache);
+    ok = ok && paged && same_tiles(mipmap, *paged) && same_lookups(mipmap, *paged);
+    ok = ok && cache.stats().evictions > 0;
+    delete paged;
+    return ok;
+}
+
+} // namespace
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+
+    // odd sizes, so that levels drop rows and edge tiles are padded
+    const int width = 203;
+    const int height = 77;
+    std::vector<uint8_t> pixels(3 * width * height);
+    uint32_t x = 1;
+    for (uint8_t &c : pixels) {
+        x = x * 1664525u + 1013904223u;
+        c = x >> 24;
+    }
+    std::vector<float> hdr_pixels(pixels.size());
+    for (size_t k = 0; k < pixels.size(); ++k) {
+        hdr_pixels[k] = pixels[k] / 16.0f;
+    }
+
+    MipMap mipmap(pixels.data(), width, height, 3);
+    ok &= check(round_trip(mipmap), "8-bit round trip, mapped and paged");
+
+    MipMap hdr_mipmap(hdr_pixels.data(), width, height, 3);
+    ok &= check(hdr_mipmap.format() == MipMap::RGB16F && round_trip(hdr_mipmap), "half float round trip");
+
+    write_texture_file(texture_file, mipmap);
+    std::vector<char> bytes = read_file(texture_file);
+
+    write_file(texture_file, bytes, bytes.size() - 1);
+    ok &= check(!load_texture_file(texture_file), "reject a truncated file");
+
+    // a size whose tiles overflow 32 bits, and a tile count that does not
+    // match the size
+    std::vector<char> damaged = bytes;
+    uint32_t size[2] = { 1u << 30, 1u << 30 };
+    memcpy(&damaged[width_field], size, sizeof(size));
+    write_file(texture_file, damaged, damaged.size());
+    ok &= check(!load_texture_file(texture_file), "reject a huge size");
+
+    damaged = bytes;
+    uint32_t tile_count = 1;
+    memcpy(&damaged[tile_count_field], &tile_count, sizeof(tile_count));
+    write_file(texture_file, damaged, damaged.size());
+    ok &= check(!load_texture_file(texture_file), "reject a wrong tile count");
+
+    remove(texture_file);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <vector>
+
+// helpers shared by the test programs: each check prints one line and
+// main returns nonzero if any failed
+
+inline bool check(bool ok, const char *what)
+{
+    std::cout << (ok ? "ok      " : "FAILED  ") << what << std::endl;
+    return ok;
+}
+
+inline std::vector<char> read_file(const char *path)
+{
+    std::ifstream in(path, std::ios::binary);
+    return std::vector<char>(std::istreambuf_iterator<char>(in), std::istreambuf_iterator<char>());
+}
+
+// writes the first `size` bytes, to truncate or damage a file on disk
+inline void write_file(const char *path, const std::vector<char> &bytes, size_t size)
+{
+    std::ofstream out(path, std::ios::binary);
+    out.write(bytes.data(), size);
+}
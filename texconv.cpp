@@ -0,0 +1,63 @@
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "texture_file.h"
+
+#include <iostream>
+#include <string.h>
+
+// Convert an image (JPEG, PNG, HDR, ... anything stb_image reads) to the
+// tiled .rttex format, with its mip pyramid; --half stores half float
+// texels, which keeps the range of high dynamic range images
+int main(int argc, char *argv[])
+{
+    bool half = false;
+    const char *input = nullptr;
+    const char *output = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--half") == 0) {
+            half = true;
+        } else if (!input) {
+            input = argv[i];
+        } else if (!output) {
+            output = argv[i];
+        }
+    }
+
+    if (!input || !output) {
+        std::cerr << "usage: " << argv[0] << " [--half] input.jpg|png|hdr output.rttex" << std::endl;
+        return 1;
+    }
+
+    int width, height, nc;
+    MipMap *mipmap = nullptr;
+    if (half) {
+        // 8-bit images keep the values the renderer reads from them, with
+        // no gamma conversion
+        stbi_ldr_to_hdr_gamma(1.0f);
+        float *data = stbi_loadf(input, &width, &height, &nc, 0);
+        if (data) {
+            mipmap = new MipMap(data, width, height, nc);
+            stbi_image_free(data);
+        }
+    } else {
+        uint8_t *data = stbi_load(input, &width, &height, &nc, 0);
+        if (data) {
+            mipmap = new MipMap(data, width, height, nc);
+            stbi_image_free(data);
+        }
+    }
+    if (!mipmap) {
+        std::cerr << "Error: can't load image " << input << std::endl;
+        return 1;
+    }
+
+    bool ok = write_texture_file(output, *mipmap);
+    if (ok) {
+        std::cout << input << ": " << width << "x" << height << ", " << mipmap->levels() << " levels, "
+                  << mipmap->tile_count() << " tiles of " << MipMap::tile_size << "x" << MipMap::tile_size
+                  << (half ? ", half float" : "") << std::endl;
+    }
+    delete mipmap;
+    return ok ? 0 : 1;
+}
@@ -2,103 +2,160 @@
 
 #include "vec3.h"
 #include "perlin.h"
+#include "mipmap.h"
 #include "utils.h"
 
+#include <stdint.h>
+
+// Closed set of texture kinds in one compact record, dispatched with a
+// switch so that lookups can be inlined. The subclasses below only
+// construct the record for their kind and add no members.
 class Texture
 {
 public:
-    virtual ~Texture() = default;
+    enum Kind : uint8_t
+    {
+        CONSTANT,
+        CHECKER,
+        NOISE,
+        IMAGE
+    };
+
+    // inputs value() depends on
+    enum Input : uint8_t
+    {
+        NEEDS_NOTHING = 0,
+        NEEDS_UV = 1,
+        NEEDS_POSITION = 2
+    };
 
-    virtual Vec3 value(float u, float v, const Vec3 &p) const = 0;
-};
+    Kind kind() const { return type; }
 
-class ConstantTexture : public Texture
-{
-public:
-    ConstantTexture() { }
-    
-    ConstantTexture(Vec3 c) : color(c) { }
+    uint8_t needs() const { return inputs; }
 
-    virtual Vec3 value(float u, float v, const Vec3 &p) const override
+    bool is_constant() const { return inputs == NEEDS_NOTHING; }
+
+    // `uv_width` and `p_width` are the widths of the area seen through the
+    // pixel, in uv units and in scene units: image textures average over
+    // it and noise leaves out the finer octaves; 0 for a point sample
+    Vec3 value(float u, float v, const Vec3 &p, float uv_width = 0.0f, float p_width = 0.0f) const
     {
-        return color;
+        switch (type) {
+        case CONSTANT:
+            return Vec3(params.constant.color[0], params.constant.color[1], params.constant.color[2]);
+        case CHECKER:
+            return checker_value(u, v, p, uv_width, p_width);
+        case NOISE:
+            return noise_value(p, p_width);
+        case IMAGE:
+            return params.image.mipmap->filtered(u, v, uv_width);
+        }
+        return Vec3(0.0);
     }
 
-private:
-    Vec3 color;
-};
+protected:
+    Texture(Kind _type, uint8_t _inputs) : type(_type), inputs(_inputs) { }
 
-class CheckerTexture : public Texture
-{
-public:
-    CheckerTexture() {}
+    struct ConstantParams
+    {
+        float color[3];
+    };
 
-    CheckerTexture(const Vec3 &color1, const Vec3 &color2, float _scale = 10.0)
-    : CheckerTexture(new ConstantTexture(color1), new ConstantTexture(color2), _scale) { }
-    
-    CheckerTexture(Texture *_texture1, Texture *_texture2, float _scale = 10.0)
-    : texture1(_texture1), texture2(_texture2), scale(_scale) { }
+    struct CheckerParams
+    {
+        const Texture *texture1;
+        const Texture *texture2;
+        float scale;
+    };
 
-    virtual Vec3 value(float u, float v, const Vec3 &p) const override
+    struct NoiseParams
     {
-        float sines = sin(scale*p.x()) * sin(scale*p.y()) * sin(scale*p.z());
-        return (sines > 0.0) ? texture1->value(u, v, p) : texture2->value(u, v, p);
-    }
+        float scale;
+    };
 
-private:
-    Texture *texture1;
-    Texture *texture2;
-    float scale;
-};
+    struct ImageParams
+    {
+        const MipMap *mipmap;
+    };
 
-class NoiseTexture : public Texture
-{
-public:
-    NoiseTexture() { }
-    
-    NoiseTexture(float _scale) : scale(_scale) { }
+    Kind type;
+    uint8_t inputs;
+    union
+    {
+        ConstantParams constant;
+        CheckerParams checker;
+        NoiseParams noise;
+        ImageParams image;
+    } params;
 
-    virtual Vec3 value(float u, float v, const Vec3 &p) const override
+private:
+    Vec3 checker_value(float u, float v, const Vec3 &p, float uv_width, float p_width) const
+    {
+        float scale = params.checker.scale;
+        float sines = sin(scale*p.x()) * sin(scale*p.y()) * sin(scale*p.z());
+        return (sines > 0.0) ? params.checker.texture1->value(u, v, p, uv_width, p_width)
+                             : params.checker.texture2->value(u, v, p, uv_width, p_width);
+    }
+
+    Vec3 noise_value(const Vec3 &p, float p_width) const
     {
         //return Vec3(1, 1, 1) * 0.5 * (Perlin::noise(p * scale) + 1.0);
         //return Vec3(1, 1, 1) * Perlin::turb(p * scale);
-        return Vec3(1, 1, 1) * 0.5 * (1.0 + sin(scale * p.z() + 10.0 * Perlin::turb(p)));
+        return Vec3(1, 1, 1) * 0.5 * (1.0 + sin(params.noise.scale * p.z() + 10.0 * Perlin::turb(p, noise_octaves(p_width))));
     }
 
-private:
-    float scale;
+    // octave i of the turbulence has features 2^-i wide, those narrower
+    // than the footprint would only alias
+    static int noise_octaves(float p_width)
+    {
+        const int max_octaves = 7;
+        if (!(p_width > 0.0f)) {
+            return max_octaves;
+        }
+        return clamp(int(-log2f(p_width)) + 1, 1, max_octaves);
+    }
 };
 
-
-class ImageTexture : public Texture
+class ConstantTexture : public Texture
 {
 public:
-    ImageTexture() { }
-    
-    ImageTexture(uint8_t *_data, int _width, int _height, int _nc)
-    : data(_data), width(_width), height(_height), nc(_nc)
+    ConstantTexture(Vec3 c) : Texture(CONSTANT, NEEDS_NOTHING)
     {
-    
+        params.constant.color[0] = c[0];
+        params.constant.color[1] = c[1];
+        params.constant.color[2] = c[2];
     }
+};
 
-    virtual Vec3 value(float u, float v, const Vec3 &p) const override
+class CheckerTexture : public Texture
+{
+public:
+    CheckerTexture(const Texture *_texture1, const Texture *_texture2, float _scale = 10.0)
+    : Texture(CHECKER, NEEDS_POSITION | _texture1->needs() | _texture2->needs())
     {
-        int i = clamp(int(u * width), 0, width);
-        int j = clamp(int((1-v) * height), 0, height);
-        
-        float r = float(data[nc*(j * width + i) + 0]) / 255.0;
-        float g = float(data[nc*(j * width + i) + 1]) / 255.0;
-        float b = float(data[nc*(j * width + i) + 2]) / 255.0;
-    
-        return Vec3(r, g, b);
+        params.checker.texture1 = _texture1;
+        params.checker.texture2 = _texture2;
+        params.checker.scale = _scale;
     }
-
-private:
-    uint8_t *data;
-    int width;
-    int height;
-    int nc;
 };
 
+class NoiseTexture : public Texture
+{
+public:
+    NoiseTexture(float _scale) : Texture(NOISE, NEEDS_POSITION)
+    {
+        params.noise.scale = _scale;
+    }
+};
 
+class ImageTexture : public Texture
+{
+public:
+    ImageTexture(const MipMap *_mipmap) : Texture(IMAGE, NEEDS_UV)
+    {
+        params.image.mipmap = _mipmap;
+    }
+};
 
+static_assert(sizeof(ConstantTexture) == sizeof(Texture) && sizeof(ImageTexture) == sizeof(Texture),
+              "texture kinds must not add members");
@@ -0,0 +1,171 @@
+#include "texture_cache.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace {
+
+std::atomic<uint64_t> next_cache_id(1);
+
+struct RecentTile
+{
+    RecentTile() : cache(0), key(0) { }
+
+    uint64_t cache;
+    uint64_t key;
+    TextureCache::Tile tile;
+};
+
+// the last tiles a thread fetched, most recent first
+thread_local RecentTile recent_tiles[TextureCache::thread_tiles];
+
+} // namespace
+
+TextureCache::TextureCache(size_t _capacity)
+: capacity(_capacity), id(next_cache_id++)
+{
+}
+
+TextureCache::~TextureCache()
+{
+    for (int fd : files) {
+        ::close(fd);
+    }
+}
+
+void TextureCache::set_capacity(size_t bytes)
+{
+    capacity = bytes;
+    for (Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        shard.evict(capacity / n_shards);
+    }
+}
+
+int TextureCache::open_file(const char *path)
+{
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    files.push_back(fd);
+    return int(files.size()) - 1;
+}
+
+TextureCache::Tile TextureCache::read_tile(int file, uint64_t offset, size_t size) const
+{
+    uint8_t *data = new uint8_t[size];
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(files[file], data + done, size - done, offset + done);
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    if (done < size) {
+        std::cerr << "Error: can't read texture tile at offset " << offset << std::endl;
+        memset(data + done, 0, size - done);
+    }
+    return Tile(data, std::default_delete<const uint8_t[]>());
+}
+
+const uint8_t *TextureCache::tile(int file, uint32_t index, uint64_t offset, size_t size)
+{
+    uint64_t key = (uint64_t(file) << 32) | index;
+    RecentTile *recent = recent_tiles;
+    if (recent[0].key == key && recent[0].cache == id) {
+        return recent[0].tile.get();
+    }
+
+    // moving to the front only swaps pointers, the least recently used
+    // tile is the one dropped on a miss
+    int k = 1;
+    while (k < thread_tiles && !(recent[k].key == key && recent[k].cache == id)) {
+        ++k;
+    }
+    if (k == thread_tiles) {
+        k = thread_tiles - 1;
+        recent[k].tile = shared_tile(key, file, offset, size);
+        recent[k].cache = id;
+        recent[k].key = key;
+    }
+    std::rotate(recent, recent + k, recent + k + 1);
+    return recent[0].tile.get();
+}
+
+TextureCache::Tile TextureCache::shared_tile(uint64_t key, int file, uint64_t offset, size_t size)
+{
+    // Fibonacci hashing, neighbouring tiles land in different shards
+    Shard &shard = shards[(key * 0x9e3779b97f4a7c15ull) >> 60];
+    static_assert(n_shards == 16, "the shard index takes the top 4 bits of the hash");
+
+    {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        auto found = shard.entries.find(key);
+        if (found != shard.entries.end()) {
+            shard.hits++;
+            shard.lru.splice(shard.lru.begin(), shard.lru, found->second.lru);
+            return found->second.tile;
+        }
+        shard.misses++;
+    }
+
+    // another thread may be reading the same tile, the first one to insert
+    // it wins and the other copy is dropped
+    Tile data = read_tile(file, offset, size);
+
+    std::lock_guard<std::mutex> lock(shard.mutex);
+    auto inserted = shard.entries.insert(std::make_pair(key, Entry()));
+    Entry &entry = inserted.first->second;
+    if (inserted.second) {
+        entry.tile = data;
+        entry.size = size;
+        shard.lru.push_front(key);
+        entry.lru = shard.lru.begin();
+        shard.resident += size;
+        // the new tile is kept even when it alone exceeds the limit
+        shard.evict(std::max(capacity / n_shards, size));
+    }
+    return entry.tile;
+}
+
+void TextureCache::Shard::evict(size_t limit)
+{
+    while (resident > limit && !lru.empty()) {
+        auto found = entries.find(lru.back());
+        resident -= found->second.size;
+        entries.erase(found);
+        lru.pop_back();
+        evictions++;
+    }
+}
+
+TextureCache::Stats TextureCache::stats() const
+{
+    Stats total = { 0, 0, 0, 0 };
+    for (const Shard &shard : shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        total.hits += shard.hits;
+        total.misses += shard.misses;
+        total.evictions += shard.evictions;
+        total.resident += shard.resident;
+    }
+    return total;
+}
+
+void TextureCache::print_stats(std::ostream &out) const
+{
+    Stats s = stats();
+    uint64_t lookups = s.hits + s.misses;
+    out << "texture cache: " << lookups << " shared tile lookups, " << s.misses << " misses";
+    if (lookups > 0) {
+        out << " (" << 100.0 * s.misses / lookups << "%)";
+    }
+    out << ", " << s.evictions << " evictions, " << (s.resident >> 10) << " KB resident of "
+        << (capacity >> 10) << " KB" << std::endl;
+}
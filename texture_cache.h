@@ -0,0 +1,108 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <iosfwd>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// Texture tiles shared by all the render threads, read from their files on
+// first use and evicted least recently used first once more than the
+// capacity is resident. Tiles are spread over independently locked shards
+// and files are read outside of the locks, so that lookups of different
+// tiles seldom wait on each other.
+//
+// In front of the shards, every thread keeps references to the last
+// `thread_tiles` tiles it fetched, so that the run of lookups in one tile
+// takes no lock and touches no reference count. Those tiles stay valid
+// when they are evicted from the shards, they only count against the
+// capacity until then.
+class TextureCache
+{
+public:
+    typedef std::shared_ptr<const uint8_t> Tile;
+
+    static const int thread_tiles = 8;
+
+    // lookups that missed the tiles of their thread
+    struct Stats
+    {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        // bytes
+        size_t resident;
+    };
+
+    explicit TextureCache(size_t _capacity = size_t(256) << 20);
+
+    ~TextureCache();
+
+    TextureCache(const TextureCache &) = delete;
+
+    TextureCache& operator=(const TextureCache &) = delete;
+
+    // in bytes, evicts what no longer fits; call it outside of parallel
+    // regions, as open_file()
+    void set_capacity(size_t bytes);
+
+    size_t get_capacity() const { return capacity; }
+
+    // returns the id of the file for tile(), or -1 if it can't be opened;
+    // the file stays open until the cache is destroyed
+    int open_file(const char *path);
+
+    // the `size` bytes at `offset` in `file`, `index` tells the tiles of
+    // one file apart; unreadable tiles are reported and read as zeros. The
+    // bytes stay valid until the calling thread has fetched thread_tiles
+    // other tiles, from any cache.
+    const uint8_t *tile(int file, uint32_t index, uint64_t offset, size_t size);
+
+    Stats stats() const;
+
+    void print_stats(std::ostream &out) const;
+
+private:
+    static const int n_shards = 16;
+
+    struct Entry
+    {
+        Tile tile;
+        size_t size;
+        std::list<uint64_t>::iterator lru;
+    };
+
+    struct Shard
+    {
+        Shard() : resident(0), hits(0), misses(0), evictions(0) { }
+
+        // drops the least recently used tiles until at most `limit` bytes
+        // are resident, with `mutex` held
+        void evict(size_t limit);
+
+        mutable std::mutex mutex;
+        // most recently used first
+        std::list<uint64_t> lru;
+        std::unordered_map<uint64_t, Entry> entries;
+        size_t resident;
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+    };
+
+    Tile read_tile(int file, uint64_t offset, size_t size) const;
+
+    // the tile from its shard, read on a miss
+    Tile shared_tile(uint64_t key, int file, uint64_t offset, size_t size);
+
+    // every shard holds an equal part of the capacity
+    Shard shards[n_shards];
+    size_t capacity;
+    std::vector<int> files;
+    // tells the caches apart in the tiles of the threads, unlike addresses
+    // it is never reused
+    uint64_t id;
+};
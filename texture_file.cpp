@@ -0,0 +1,123 @@
+#include "texture_file.h"
+#include "mapped_file.h"
+
+#include <algorithm>
+#include <iostream>
+#include <stdio.h>
+#include <string.h>
+
+namespace {
+
+const char texture_magic[8] = { 'R', 'T', 'T', 'E', 'X', 0, 0, 0 };
+const uint32_t texture_version = 1;
+
+struct TextureFileHeader
+{
+    char magic[8];
+    uint32_t version;
+    // MipMap::Format
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t levels;
+    uint32_t tile_size;
+    uint32_t tile_count;
+    uint32_t reserved;
+    uint64_t tiles_offset;
+};
+
+// tiles start on a page boundary
+const uint64_t tiles_alignment = 4096;
+
+// levels and tiles of a pyramid cut as by MipMap, counted in 64 bits so
+// that any header can be checked before a MipMap is laid out from it
+uint64_t pyramid_tiles(uint64_t width, uint64_t height, uint32_t &levels)
+{
+    uint64_t tiles = 0;
+    levels = 0;
+    for (;;) {
+        uint64_t tiles_x = (width + MipMap::tile_size - 1) / MipMap::tile_size;
+        uint64_t tiles_y = (height + MipMap::tile_size - 1) / MipMap::tile_size;
+        tiles += tiles_x * tiles_y;
+        levels++;
+        if (width == 1 && height == 1) {
+            return tiles;
+        }
+        width = std::max<uint64_t>(1, width / 2);
+        height = std::max<uint64_t>(1, height / 2);
+    }
+}
+
+} // namespace
+
+bool write_texture_file(const char *path, const MipMap &mipmap)
+{
+    TextureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, texture_magic, sizeof(texture_magic));
+    header.version = texture_version;
+    header.format = mipmap.format();
+    header.width = mipmap.width(0);
+    header.height = mipmap.height(0);
+    header.levels = mipmap.levels();
+    header.tile_size = MipMap::tile_size;
+    header.tile_count = mipmap.tile_count();
+    header.tiles_offset = tiles_alignment;
+
+    FILE *f = fopen(path, "wb");
+    if (!f) {
+        std::cerr << "Error: can't write " << path << std::endl;
+        return false;
+    }
+
+    static const char zeros[tiles_alignment] = { 0 };
+    bool ok = fwrite(&header, sizeof(header), 1, f) == 1
+        && fwrite(zeros, header.tiles_offset - sizeof(header), 1, f) == 1;
+    for (uint32_t i = 0; ok && i < header.tile_count; ++i) {
+        ok = fwrite(mipmap.tile(i), mipmap.tile_bytes(), 1, f) == 1;
+    }
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok) {
+        std::cerr << "Error: failed writing " << path << std::endl;
+        remove(path);
+    }
+    return ok;
+}
+
+MipMap *load_texture_file(const char *path, TextureCache *cache)
+{
+    // the header is read from a mapping in both cases, only the pages that
+    // lookups touch are read afterwards
+    MappedFile mapping;
+    TextureFileHeader header;
+    bool ok = mapping.open(path) && mapping.size() >= sizeof(header);
+    if (ok) {
+        memcpy(&header, mapping.data(), sizeof(header));
+        uint64_t tile_bytes = MipMap::tile_size * MipMap::tile_size * (header.format == MipMap::RGB8 ? 3 : 6);
+        ok = memcmp(header.magic, texture_magic, sizeof(texture_magic)) == 0
+            && header.version == texture_version
+            && (header.format == MipMap::RGB8 || header.format == MipMap::RGB16F)
+            && header.tile_size == MipMap::tile_size && header.tiles_offset % tiles_alignment == 0
+            && header.width > 0 && header.width <= 1u << 30 && header.height > 0 && header.height <= 1u << 30
+            && header.tiles_offset <= mapping.size();
+        if (ok) {
+            // the tiles the size calls for must be the ones the header
+            // counts, and all be in the file
+            uint32_t levels;
+            uint64_t tiles = pyramid_tiles(header.width, header.height, levels);
+            ok = levels == header.levels && tiles == header.tile_count
+                && tiles * tile_bytes <= mapping.size() - header.tiles_offset;
+        }
+    }
+    int file = ok && cache ? cache->open_file(path) : -1;
+    if (!ok || (cache && file < 0)) {
+        std::cerr << "Error: can't load texture file " << path << std::endl;
+        return nullptr;
+    }
+
+    MipMap::Format format = MipMap::Format(header.format);
+    MipMap *mipmap = cache ? new MipMap(header.width, header.height, format, cache, file, header.tiles_offset)
+                           : new MipMap(header.width, header.height, format, mapping, header.tiles_offset);
+    return mipmap;
+}
@@ -0,0 +1,16 @@
+#pragma once
+
+#include "mipmap.h"
+
+// Tiled texture container (.rttex): a header followed by the tiles of every
+// level of the mip pyramid, finest level first, from a 4096-byte aligned
+// offset. Loading reads only the header; the tiles are then mapped in place
+// or paged in by a texture cache as lookups reach them, so that a texture
+// costs no decoding and memory only for the parts that are seen. texconv
+// converts images to this format.
+
+bool write_texture_file(const char *path, const MipMap &mipmap);
+
+// without `cache` the file is mapped; returns null if the file can't be
+// read or is inconsistent
+MipMap *load_texture_file(const char *path, TextureCache *cache = nullptr);
@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+std::atomic<bool> tracing(false);
+
+namespace {
+
+struct TraceEvent
+{
+    const char *name;
+    uint64_t start;
+    uint64_t end;
+};
+
+struct TraceBuffer
+{
+    int tid;
+    std::vector<TraceEvent> events;
+};
+
+std::chrono::steady_clock::time_point origin;
+
+// the buffers outlive their threads, write_trace() reads them at the end
+std::mutex registry_mutex;
+std::vector<std::unique_ptr<TraceBuffer>> registry;
+
+thread_local TraceBuffer *thread_buffer = nullptr;
+
+TraceBuffer *register_thread()
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    registry.push_back(std::unique_ptr<TraceBuffer>(new TraceBuffer));
+    TraceBuffer *buffer = registry.back().get();
+    buffer->tid = registry.size() - 1;
+    buffer->events.reserve(1024);
+    return buffer;
+}
+
+void write_name(std::ostream &out, const char *name)
+{
+    out << '"';
+    for (const char *c = name; *c; ++c) {
+        if (*c == '"' || *c == '\\') {
+            out << '\\';
+        }
+        out << *c;
+    }
+    out << '"';
+}
+
+} // namespace
+
+void start_trace()
+{
+    origin = std::chrono::steady_clock::now();
+    tracing.store(true, std::memory_order_relaxed);
+    // the calling thread comes first in the viewer
+    if (!thread_buffer) {
+        thread_buffer = register_thread();
+    }
+}
+
+uint64_t trace_clock()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - origin).count();
+}
+
+void record_event(const char *name, uint64_t start, uint64_t end)
+{
+    if (!thread_buffer) {
+        thread_buffer = register_thread();
+    }
+    TraceEvent event = { name, start, end };
+    thread_buffer->events.push_back(event);
+}
+
+bool write_trace(const char *path)
+{
+    std::lock_guard<std::mutex> lock(registry_mutex);
+    std::ofstream out(path);
+    out << "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n";
+    out.precision(3);
+    out << std::fixed;
+    bool first = true;
+    for (const std::unique_ptr<TraceBuffer> &buffer : registry) {
+        out << (first ? "" : ",\n")
+            << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": " << buffer->tid
+            << ", \"args\": {\"name\": \"thread " << buffer->tid << "\"}}";
+        first = false;
+        // complete events, times in microseconds
+        for (const TraceEvent &event : buffer->events) {
+            out << ",\n{\"name\": ";
+            write_name(out, event.name);
+            out << ", \"ph\": \"X\", \"pid\": 1, \"tid\": " << buffer->tid
+                << ", \"ts\": " << event.start * 1e-3
+                << ", \"dur\": " << (event.end - event.start) * 1e-3 << "}";
+        }
+    }
+    out << "\n]}\n";
+
+    if (!out) {
+        std::cerr << "Error: can't write " << path << std::endl;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,55 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Timeline of the render phases in the Chrome trace format, to be opened
+// in chrome://tracing or Perfetto. TRACE_SCOPE(name) records the time
+// spent in the enclosing scope once start_trace() was called. Each thread
+// appends to its own buffer, the only lock is taken on its first event.
+// `name` must outlive the trace, in practice it is a string literal.
+
+void start_trace();
+
+// writes the events of every thread so far, call it outside of parallel
+// regions
+bool write_trace(const char *path);
+
+// set by start_trace() while the render threads read it; the threads see
+// the rest of the trace state through the start of their parallel region,
+// so relaxed loads are enough
+extern std::atomic<bool> tracing;
+
+// nanoseconds since start_trace()
+uint64_t trace_clock();
+
+void record_event(const char *name, uint64_t start, uint64_t end);
+
+class TraceScope
+{
+public:
+    explicit TraceScope(const char *_name)
+    : name(_name), active(tracing.load(std::memory_order_relaxed)), start(active ? trace_clock() : 0)
+    {
+    }
+
+    ~TraceScope()
+    {
+        if (active) {
+            record_event(name, start, trace_clock());
+        }
+    }
+
+    TraceScope(const TraceScope &) = delete;
+
+    TraceScope& operator=(const TraceScope &) = delete;
+
+private:
+    const char *name;
+    bool active;
+    uint64_t start;
+};
+
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
@@ -17,6 +17,19 @@ inline uint32_t XorShift32()
     return x;
 }
 
+// restarts the generator of the calling thread (in this translation unit)
+// at a state derived from a seed and a stream number, e.g. an image row
+inline void seed_random(uint32_t seed, uint32_t stream)
+{
+    uint32_t x = seed * 0x9e3779b9u ^ (stream + 1) * 0x85ebca6bu;
+    x ^= x >> 16;
+    x *= 0x7feb352du;
+    x ^= x >> 15;
+    x *= 0x846ca68bu;
+    x ^= x >> 16;
+    s_RndState = x ? x : 1;
+}
+
 inline float my_random()
 {
     return float(XorShift32()) / std::numeric_limits<uint32_t>::max();
@@ -37,6 +50,13 @@ inline Vec3 random_in_unit_sphere()
     return v;
 }
 
+// uniform on the sphere, so that normal + random_unit_vector() is
+// distributed with density cos(theta) / pi around the normal
+inline Vec3 random_unit_vector()
+{
+    return unit_vector(random_in_unit_sphere());
+}
+
 inline Vec3 random_in_unit_disk()
 {
     Vec3 v;
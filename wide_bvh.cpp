@@ -0,0 +1,154 @@
+#include "wide_bvh.h"
+
+#include <math.h>
+
+namespace {
+
+float surface_area(const BVHFlatNode &node)
+{
+    Vec3 d = node.bmax - node.bmin;
+    return 2.0f * (d.x() * d.y() + d.y() * d.z() + d.z() * d.x());
+}
+
+// smallest exponent such that 255 steps from `origin` cover `hi`
+int quantization_exponent(float origin, float hi)
+{
+    float extent = hi - origin;
+    int e = -126;
+    if (extent > 0.0f) {
+        e = int(ceilf(log2f(extent / 255.0f)));
+        e = e < -126 ? -126 : e;
+    }
+    while (e < 127 && origin + 255 * exp2_int(e) < hi) {
+        ++e;
+    }
+    return e;
+}
+
+// the decoding expression must match WideBVH::hit exactly
+uint8_t quantize_down(float x, float origin, float scale)
+{
+    int q = int(floorf((x - origin) / scale));
+    q = q < 0 ? 0 : (q > 255 ? 255 : q);
+    while (q > 0 && origin + q * scale > x) {
+        --q;
+    }
+    return uint8_t(q);
+}
+
+uint8_t quantize_up(float x, float origin, float scale)
+{
+    int q = int(ceilf((x - origin) / scale));
+    q = q < 0 ? 0 : (q > 255 ? 255 : q);
+    while (q < 255 && origin + q * scale < x) {
+        ++q;
+    }
+    return uint8_t(q);
+}
+
+struct Collapser
+{
+    const BVHFlatNode *binary;
+    std::vector<QBVHNode> &nodes;
+
+    uint32_t collapse(uint32_t b)
+    {
+        // gather up to four descendants, always opening the interior node
+        // with the largest area
+        uint32_t children[4];
+        int n = 0;
+        if (binary[b].count > 0) {
+            children[n++] = b;
+        } else {
+            children[n++] = b + 1;
+            children[n++] = binary[b].offset;
+        }
+        while (n < 4) {
+            int best = -1;
+            float best_area = -1.0f;
+            for (int c = 0; c < n; ++c) {
+                const BVHFlatNode &child = binary[children[c]];
+                if (child.count == 0 && surface_area(child) > best_area) {
+                    best_area = surface_area(child);
+                    best = c;
+                }
+            }
+            if (best < 0) break;
+            uint32_t opened = children[best];
+            children[best] = opened + 1;
+            children[n++] = binary[opened].offset;
+        }
+
+        uint32_t index = nodes.size();
+        nodes.push_back(QBVHNode());
+
+        uint32_t targets[4];
+        for (int c = 0; c < n; ++c) {
+            const BVHFlatNode &child = binary[children[c]];
+            targets[c] = child.count > 0 ? child.offset : collapse(children[c]);
+        }
+
+        QBVHNode &node = nodes[index];
+        node.n_children = n;
+        node.pad = 0;
+
+        const BVHFlatNode &parent = binary[b];
+        for (int a = 0; a < 3; ++a) {
+            node.origin[a] = parent.bmin[a];
+            node.exponent[a] = quantization_exponent(parent.bmin[a], parent.bmax[a]);
+            float scale = exp2_int(node.exponent[a]);
+            for (int c = 0; c < 4; ++c) {
+                if (c < n) {
+                    node.qmin[a][c] = quantize_down(binary[children[c]].bmin[a], node.origin[a], scale);
+                    node.qmax[a][c] = quantize_up(binary[children[c]].bmax[a], node.origin[a], scale);
+                } else {
+                    node.qmin[a][c] = 255;
+                    node.qmax[a][c] = 0;
+                }
+            }
+        }
+        for (int c = 0; c < 4; ++c) {
+            node.child[c] = c < n ? targets[c] : 0;
+            node.count[c] = c < n ? binary[children[c]].count : 0;
+        }
+
+        return index;
+    }
+};
+
+} // namespace
+
+void WideBVH::build(const BVHTree &tree)
+{
+    nodes.clear();
+    indices.resize(tree.index_count());
+    for (uint32_t i = 0; i < tree.index_count(); ++i) {
+        indices[i] = tree.primitive(i);
+    }
+
+    if (tree.node_count() == 0) {
+        return;
+    }
+
+    tree.bounds(root_box);
+    nodes.reserve(tree.node_count() / 2 + 1);
+    Collapser collapser = { tree.node_data(), nodes };
+    collapser.collapse(0);
+}
+
+QuantizedBVH::QuantizedBVH(const std::vector<Hitable *> &hitables, const BVHSettings &settings, const char *cache_dir)
+{
+    std::vector<Hitable *> bounded;
+    std::vector<AABB> boxes;
+    collect_bounded(hitables, bounded, boxes);
+
+    // the binary tree is only needed to derive the wide one
+    BVHTree binary;
+    cached = load_or_build(binary, boxes, settings, cache_dir);
+    tree.build(binary);
+
+    prims.resize(bounded.size());
+    for (size_t i = 0; i < bounded.size(); ++i) {
+        prims[i] = bounded[tree.primitive(i)];
+    }
+}
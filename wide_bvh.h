@@ -0,0 +1,385 @@
+#pragma once
+
+#include "bvh.h"
+
+#include <stdint.h>
+#include <vector>
+
+// 64 byte node with up to four children whose boxes are stored as 8 bit
+// offsets from `origin` in steps of 2^exponent per axis, rounded outwards.
+// Leaf children have count > 0 and reference the index array at `child`,
+// interior children have count == 0 and `child` is a node index.
+struct QBVHNode
+{
+    float origin[3];
+    int8_t exponent[3];
+    uint8_t n_children;
+    uint8_t qmin[3][4];
+    uint8_t qmax[3][4];
+    uint32_t child[4];
+    uint8_t count[4];
+    uint32_t pad;
+};
+
+static_assert(sizeof(QBVHNode) == 64, "QBVHNode must fit a cache line");
+
+// power of two built from a biased exponent, exact and branch free
+inline float exp2_int(int e)
+{
+    union { uint32_t i; float f; } bits;
+    bits.i = uint32_t(e + 127) << 23;
+    return bits.f;
+}
+
+// Four-wide quantized BVH, obtained by collapsing a binary BVHTree
+class WideBVH
+{
+public:
+    WideBVH() { }
+
+    void build(const BVHTree &tree);
+
+    size_t node_count() const { return nodes.size(); }
+
+    size_t memory_size() const { return nodes.size() * sizeof(QBVHNode); }
+
+    uint32_t primitive(uint32_t i) const { return indices[i]; }
+
+    bool bounds(AABB &box) const
+    {
+        if (nodes.empty()) return false;
+        box = root_box;
+        return true;
+    }
+
+    // same contract as BVHTree::hit
+    template<typename LeafHit>
+    bool hit(const Ray &ray, float tmin, float tmax, Hit &hit, LeafHit leaf_hit) const;
+
+    // same contract as BVHTree::hit_packet, for coherent packets
+    template<typename LeafHit>
+    uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits, LeafHit leaf_hit) const;
+
+    // same contract as BVHTree::occluded and occluded_packet
+    template<typename LeafOccluded>
+    bool occluded(const Ray &ray, float tmin, float tmax, LeafOccluded leaf_occluded) const;
+
+    template<typename LeafOccluded>
+    uint32_t occluded_packet(RayPacket &packet, float tmin, LeafOccluded leaf_occluded) const;
+
+private:
+    std::vector<QBVHNode> nodes;
+    std::vector<uint32_t> indices;
+    AABB root_box;
+};
+
+template<typename LeafHit>
+bool WideBVH::hit(const Ray &ray, float tmin, float tmax, Hit &hit, LeafHit leaf_hit) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+
+    STAT_BIND(stats);
+    Vec3 orig = ray.origin();
+    Vec3 dir = ray.direction();
+    Vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+
+    struct Entry { uint32_t node; float t; };
+    // each pop pushes at most three entries more than it removes
+    Entry stack[256];
+    int sp = 0;
+    stack[sp++] = { 0, tmin };
+    bool got_hit = false;
+
+    while (sp > 0) {
+        Entry entry = stack[--sp];
+        if (entry.t > tmax) continue;
+
+        const QBVHNode &node = nodes[entry.node];
+        STAT_INC_TO(stats, nodes_visited);
+        float scale[3] = { exp2_int(node.exponent[0]), exp2_int(node.exponent[1]), exp2_int(node.exponent[2]) };
+
+        Entry hits[4];
+        int n_hits = 0;
+        for (int c = 0; c < node.n_children; ++c) {
+            float t0 = tmin;
+            float t1 = tmax;
+            for (int a = 0; a < 3; ++a) {
+                float lo = node.origin[a] + node.qmin[a][c] * scale[a];
+                float hi = node.origin[a] + node.qmax[a][c] * scale[a];
+                float ta = (lo - orig[a]) * inv_dir[a];
+                float tb = (hi - orig[a]) * inv_dir[a];
+                if (inv_dir[a] < 0.0f) {
+                    std::swap(ta, tb);
+                }
+                t0 = ta > t0 ? ta : t0;
+                t1 = tb < t1 ? tb : t1;
+            }
+            if (t0 > t1) continue;
+
+            if (node.count[c] > 0) {
+                STAT_ADD_TO(stats, primitive_tests, node.count[c]);
+                for (uint32_t i = node.child[c]; i < node.child[c] + node.count[c]; ++i) {
+                    if (leaf_hit(i, ray, tmin, tmax, hit)) {
+                        got_hit = true;
+                        tmax = hit.t;
+                    }
+                }
+            } else {
+                // insertion keeps the farthest child first, so that the
+                // nearest one ends up on top of the stack
+                int k = n_hits++;
+                while (k > 0 && hits[k - 1].t < t0) {
+                    hits[k] = hits[k - 1];
+                    --k;
+                }
+                hits[k] = { node.child[c], t0 };
+            }
+        }
+
+        for (int k = 0; k < n_hits; ++k) {
+            stack[sp++] = hits[k];
+        }
+    }
+
+    return got_hit;
+}
+
+template<typename LeafHit>
+uint32_t WideBVH::hit_packet(RayPacket &packet, float tmin, Hit *hits, LeafHit leaf_hit) const
+{
+    if (nodes.empty()) {
+        return 0;
+    }
+
+    STAT_BIND(stats);
+    uint32_t stack[256];
+    int sp = 0;
+    stack[sp++] = 0;
+    uint32_t got_hit = 0;
+
+    while (sp > 0) {
+        const QBVHNode &node = nodes[stack[--sp]];
+        // a visit counts once for the whole packet
+        STAT_INC_TO(stats, nodes_visited);
+        float scale[3] = { exp2_int(node.exponent[0]), exp2_int(node.exponent[1]), exp2_int(node.exponent[2]) };
+
+        struct Entry { uint32_t node; float key; };
+        Entry inner[4];
+        int n_inner = 0;
+        for (int c = 0; c < node.n_children; ++c) {
+            Vec3 bmin, bmax;
+            for (int a = 0; a < 3; ++a) {
+                bmin[a] = node.origin[a] + node.qmin[a][c] * scale[a];
+                bmax[a] = node.origin[a] + node.qmax[a][c] * scale[a];
+            }
+            uint32_t mask = 0;
+            if (packet.may_hit(bmin, bmax, tmin)) {
+                mask = packet.hit_mask(bmin, bmax, tmin);
+            }
+            if (!mask) continue;
+
+            if (node.count[c] > 0) {
+                for (uint32_t i = node.child[c]; i < node.child[c] + node.count[c]; ++i) {
+                    for (int k = 0; k < RayPacket::size; ++k) {
+                        if (!(mask >> k & 1)) {
+                            continue;
+                        }
+                        STAT_INC_TO(stats, primitive_tests);
+                        if (leaf_hit(i, packet.ray(k), tmin, packet.tmax(k), hits[k])) {
+                            got_hit |= 1u << k;
+                            packet.shorten(k, hits[k].t);
+                        }
+                    }
+                }
+            } else {
+                // the rays share an octant, so the corner of the box they
+                // enter first orders the children front to back; the
+                // farthest is pushed first
+                float key = 0.0f;
+                for (int a = 0; a < 3; ++a) {
+                    key += packet.direction_negative(a) ? -bmax[a] : bmin[a];
+                }
+                int k = n_inner++;
+                while (k > 0 && inner[k - 1].key < key) {
+                    inner[k] = inner[k - 1];
+                    --k;
+                }
+                inner[k] = { node.child[c], key };
+            }
+        }
+
+        for (int k = 0; k < n_inner; ++k) {
+            stack[sp++] = inner[k].node;
+        }
+    }
+
+    return got_hit;
+}
+
+template<typename LeafOccluded>
+bool WideBVH::occluded(const Ray &ray, float tmin, float tmax, LeafOccluded leaf_occluded) const
+{
+    if (nodes.empty()) {
+        return false;
+    }
+
+    STAT_BIND(stats);
+    Vec3 orig = ray.origin();
+    Vec3 dir = ray.direction();
+    Vec3 inv_dir(1.0f / dir.x(), 1.0f / dir.y(), 1.0f / dir.z());
+
+    // any blocker ends the traversal, the children go in node order
+    uint32_t stack[256];
+    int sp = 0;
+    stack[sp++] = 0;
+
+    while (sp > 0) {
+        const QBVHNode &node = nodes[stack[--sp]];
+        STAT_INC_TO(stats, nodes_visited);
+        float scale[3] = { exp2_int(node.exponent[0]), exp2_int(node.exponent[1]), exp2_int(node.exponent[2]) };
+
+        for (int c = 0; c < node.n_children; ++c) {
+            float t0 = tmin;
+            float t1 = tmax;
+            for (int a = 0; a < 3; ++a) {
+                float lo = node.origin[a] + node.qmin[a][c] * scale[a];
+                float hi = node.origin[a] + node.qmax[a][c] * scale[a];
+                float ta = (lo - orig[a]) * inv_dir[a];
+                float tb = (hi - orig[a]) * inv_dir[a];
+                if (inv_dir[a] < 0.0f) {
+                    std::swap(ta, tb);
+                }
+                t0 = ta > t0 ? ta : t0;
+                t1 = tb < t1 ? tb : t1;
+            }
+            if (t0 > t1) continue;
+
+            if (node.count[c] > 0) {
+                for (uint32_t i = node.child[c]; i < node.child[c] + node.count[c]; ++i) {
+                    STAT_INC_TO(stats, primitive_tests);
+                    if (leaf_occluded(i, ray, tmin, tmax)) {
+                        return true;
+                    }
+                }
+            } else {
+                stack[sp++] = node.child[c];
+            }
+        }
+    }
+
+    return false;
+}
+
+template<typename LeafOccluded>
+uint32_t WideBVH::occluded_packet(RayPacket &packet, float tmin, LeafOccluded leaf_occluded) const
+{
+    if (nodes.empty()) {
+        return 0;
+    }
+
+    STAT_BIND(stats);
+    uint32_t stack[256];
+    int sp = 0;
+    stack[sp++] = 0;
+    uint32_t blocked = 0;
+
+    while (sp > 0 && packet.active()) {
+        const QBVHNode &node = nodes[stack[--sp]];
+        STAT_INC_TO(stats, nodes_visited);
+        float scale[3] = { exp2_int(node.exponent[0]), exp2_int(node.exponent[1]), exp2_int(node.exponent[2]) };
+
+        for (int c = 0; c < node.n_children; ++c) {
+            Vec3 bmin, bmax;
+            for (int a = 0; a < 3; ++a) {
+                bmin[a] = node.origin[a] + node.qmin[a][c] * scale[a];
+                bmax[a] = node.origin[a] + node.qmax[a][c] * scale[a];
+            }
+            uint32_t mask = 0;
+            if (packet.may_hit(bmin, bmax, tmin)) {
+                mask = packet.hit_mask(bmin, bmax, tmin);
+            }
+            if (!mask) continue;
+
+            if (node.count[c] > 0) {
+                for (uint32_t i = node.child[c]; i < node.child[c] + node.count[c] && mask; ++i) {
+                    for (int k = 0; k < RayPacket::size; ++k) {
+                        if (!(mask >> k & 1)) {
+                            continue;
+                        }
+                        STAT_INC_TO(stats, primitive_tests);
+                        if (leaf_occluded(i, packet.ray(k), tmin, packet.tmax(k))) {
+                            blocked |= 1u << k;
+                            mask &= ~(1u << k);
+                            packet.retire(k);
+                        }
+                    }
+                }
+            } else {
+                stack[sp++] = node.child[c];
+            }
+        }
+    }
+
+    return blocked;
+}
+
+// Hitable wrapper, same caching behaviour as LinearBVH
+class QuantizedBVH : public Hitable
+{
+public:
+    QuantizedBVH(const std::vector<Hitable *> &hitables, const BVHSettings &settings = BVHSettings(),
+                 const char *cache_dir = nullptr);
+
+    virtual bool hit(const Ray &ray, float tmin, float tmax, Hit &hit) const override
+    {
+        return tree.hit(ray, tmin, tmax, hit,
+            [this](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+                return prims[i]->hit(r, t0, t1, h);
+            });
+    }
+
+    // packets whose rays go in different octants are traced ray by ray
+    virtual uint32_t hit_packet(RayPacket &packet, float tmin, Hit *hits) const override
+    {
+        if (!packet.is_coherent()) {
+            return Hitable::hit_packet(packet, tmin, hits);
+        }
+        return tree.hit_packet(packet, tmin, hits,
+            [this](uint32_t i, const Ray &r, float t0, float t1, Hit &h) {
+                return prims[i]->hit(r, t0, t1, h);
+            });
+    }
+
+    virtual bool occluded(const Ray &ray, float tmin, float tmax) const override
+    {
+        return tree.occluded(ray, tmin, tmax,
+            [this](uint32_t i, const Ray &r, float t0, float t1) {
+                return prims[i]->occluded(r, t0, t1);
+            });
+    }
+
+    virtual uint32_t occluded_packet(RayPacket &packet, float tmin) const override
+    {
+        if (!packet.is_coherent()) {
+            return Hitable::occluded_packet(packet, tmin);
+        }
+        return tree.occluded_packet(packet, tmin,
+            [this](uint32_t i, const Ray &r, float t0, float t1) {
+                return prims[i]->occluded(r, t0, t1);
+            });
+    }
+
+    virtual bool bounding_box(AABB &box) const override
+    {
+        return tree.bounds(box);
+    }
+
+    bool loaded_from_cache() const { return cached; }
+
+private:
+    std::vector<Hitable *> prims;
+    WideBVH tree;
+    bool cached;
+};
@@ -25,6 +25,9 @@ public:
             hit.normal = Vec3(0.0, 0.0, 1.0);
             hit.u = (xi - x0) / (x1 - x0);
             hit.v = (yi - y0) / (y1 - y0);
+            hit.dpdu = Vec3(x1 - x0, 0.0, 0.0);
+            hit.dpdv = Vec3(0.0, y1 - y0, 0.0);
+            hit.curvature = 0.0f;
             hit.t = ti;
             hit.material = material;
             return true;